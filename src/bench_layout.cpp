@@ -0,0 +1,103 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+
+#include "dmodel.hpp"
+
+void showUsage(char *argv[]);
+
+/*
+ * Time the same trained model on the pointer-based tree and on both compact layouts.
+ */
+template <typename Model>
+double benchmark(const Model& model, const std::vector<std::map<int, double> >& rows, const int& repeats, long& checksum)
+{
+	std::vector<int> conclusions;
+	auto start = std::chrono::steady_clock::now();
+	for (int r = 0; r < repeats; r++)
+	{
+		model.classify(rows, conclusions);
+		for (const auto& c : conclusions)
+		{
+			checksum += c;
+		}
+	}
+	double elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+	return elapsed / ((double)rows.size() * repeats);
+}
+
+template <typename Model, typename Compact>
+void run(std::istream& input, const std::vector<std::map<int, double> >& rows, const int& repeats)
+{
+	Model model(input);
+	Compact preorder(model, dtree::layout::preorder);
+	Compact hot_path(model, dtree::layout::hot_path);
+
+	long checksums[3] = { 0, 0, 0 };
+	double pointer_ns = benchmark(model, rows, repeats, checksums[0]);
+	double preorder_ns = benchmark(preorder, rows, repeats, checksums[1]);
+	double hot_path_ns = benchmark(hot_path, rows, repeats, checksums[2]);
+
+	std::cout << std::fixed << std::setprecision(1);
+	std::cout << "pointer:  " << pointer_ns << " ns/row" << std::endl;
+	std::cout << "preorder: " << preorder_ns << " ns/row (" << preorder.get_memory_usage() << " bytes)" << std::endl;
+	std::cout << "hot_path: " << hot_path_ns << " ns/row (" << hot_path.get_memory_usage() << " bytes)" << std::endl;
+	if ((checksums[0] != checksums[1]) || (checksums[1] != checksums[2]))
+	{
+		std::cout << "warning: layouts disagree on some rows" << std::endl;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	if ((argc != 3) && (argc != 4))
+	{
+		showUsage(argv);
+	}
+	int repeats = (argc == 4) ? std::stoi(argv[3]) : 100;
+
+	std::vector<std::map<int, double> > rows;
+	std::ifstream test(argv[2]);
+	std::string line;
+	while (std::getline(test, line))
+	{
+		std::map<int, double> features;
+		int conclusion;
+		if (!line.empty())
+		{
+			dmodel::parse_libsvm(line, features, conclusion);
+			rows.push_back(features);
+		}
+	}
+	if (rows.empty())
+	{
+		std::cerr << "No rows in \"" << argv[2] << "\"" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	std::ifstream input(argv[1]);
+	std::string kind;
+	input >> kind;
+	input.seekg(0);
+	if (kind == "forest")
+	{
+		run<dforest::if_forest, dforest::compact_forest>(input, rows, repeats);
+	}
+	else
+	{
+		run<dtree::if_tree, dtree::compact_tree>(input, rows, repeats);
+	}
+
+	return EXIT_SUCCESS;
+}
+
+void showUsage(char *argv[])
+{
+	std::cout << "Usage: " << argv[0] << " model" << " filename" << " [repeats]" << std::endl;
+	std::exit(EXIT_FAILURE);
+}
@@ -0,0 +1,200 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <map>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+#include "dserve.hpp"
+
+void showUsage(char *argv[]);
+
+/*
+ * Load generator for the prediction server, every connection replays the test file round-robin.
+ */
+int main(int argc, char *argv[])
+{
+	if (argc < 2)
+	{
+		showUsage(argv);
+	}
+
+	std::string socket_path, host = "127.0.0.1";
+	int port = -1;
+	int connections = 8;
+	long requests = 100000;
+	bool binary = false;
+	for (int i = 2; i < argc; i++)
+	{
+		std::string option(argv[i]);
+		if (option == "-x")
+		{
+			binary = true;
+		}
+		else if (i + 1 >= argc)
+		{
+			showUsage(argv);
+		}
+		else if (option == "-u")
+		{
+			socket_path = argv[++i];
+		}
+		else if (option == "-p")
+		{
+			port = std::stoi(argv[++i]);
+		}
+		else if (option == "-h")
+		{
+			host = argv[++i];
+		}
+		else if (option == "-c")
+		{
+			connections = std::stoi(argv[++i]);
+		}
+		else if (option == "-n")
+		{
+			requests = std::stol(argv[++i]);
+		}
+		else
+		{
+			showUsage(argv);
+		}
+	}
+	if ((socket_path.empty() == (port < 0)) || (connections <= 0) || (requests <= 0))
+	{
+		showUsage(argv);
+	}
+
+	/*
+	 * (request payload, expected conclusion)
+	 */
+	std::vector<std::pair<std::string, int> > payloads;
+	std::ifstream input(argv[1]);
+	std::string line;
+	while (std::getline(input, line))
+	{
+		std::map<int, double> features;
+		int conclusion;
+		if (line.empty())
+		{
+			continue;
+		}
+		dmodel::parse_libsvm(line, features, conclusion);
+
+		std::string payload;
+		if (binary)
+		{
+			dserve::encode_frame(features, payload);
+		}
+		else
+		{
+			payload = line + '\n';
+		}
+		payloads.push_back(std::make_pair(payload, conclusion));
+	}
+	if (payloads.empty())
+	{
+		std::cerr << "No requests in \"" << argv[1] << "\"" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	std::atomic<long> issued(0), correct(0), failed(0);
+	std::vector<std::vector<double> > latencies(connections);
+	std::vector<std::thread> workers;
+
+	auto start = std::chrono::steady_clock::now();
+	for (int c = 0; c < connections; c++)
+	{
+		workers.push_back(std::thread([&, c]() {
+			int fd = socket_path.empty() ? dserve::connect_tcp(host, port) : dserve::connect_unix(socket_path);
+			if (fd < 0)
+			{
+				failed++;
+				return;
+			}
+			dserve::connection stream(fd);
+
+			long index;
+			std::string response;
+			while ((index = issued++) < requests)
+			{
+				const auto& payload = payloads[index % payloads.size()];
+				auto begin = std::chrono::steady_clock::now();
+
+				int conclusion;
+				if (!stream.write_all(payload.first))
+				{
+					failed++;
+					return;
+				}
+				if (binary)
+				{
+					int32_t result;
+					if (!stream.read_exact(&result, sizeof(result)))
+					{
+						failed++;
+						return;
+					}
+					conclusion = result;
+				}
+				else
+				{
+					if (!stream.read_line(response))
+					{
+						failed++;
+						return;
+					}
+					conclusion = std::atoi(response.c_str());
+				}
+
+				latencies[c].push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - begin).count());
+				if (conclusion == payload.second)
+				{
+					correct++;
+				}
+			}
+		}));
+	}
+	for (auto& worker : workers)
+	{
+		worker.join();
+	}
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	std::vector<double> samples;
+	for (const auto& l : latencies)
+	{
+		samples.insert(samples.end(), l.begin(), l.end());
+	}
+	std::sort(samples.begin(), samples.end());
+
+	std::cout << std::fixed << std::setprecision(1);
+	std::cout << "requests=" << samples.size() << " failed=" << failed;
+	std::cout << " p50_us=" << dserve::latency_stats::percentile(samples, 0.50);
+	std::cout << " p99_us=" << dserve::latency_stats::percentile(samples, 0.99);
+	std::cout << " rows_per_s=" << samples.size() / elapsed;
+	std::cout << std::setprecision(4) << " accuracy=" << (samples.empty() ? 0 : correct / (double)samples.size()) << std::endl;
+
+	// Ask the server for its own view of the run.
+	int fd = socket_path.empty() ? dserve::connect_tcp(host, port) : dserve::connect_unix(socket_path);
+	if (fd >= 0)
+	{
+		dserve::connection stream(fd);
+		if (stream.write_all(std::string("#stats\n")) && stream.read_line(line))
+		{
+			std::cout << "server: " << line << std::endl;
+		}
+	}
+
+	return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+void showUsage(char *argv[])
+{
+	std::cout << "Usage: " << argv[0] << " filename" << " (-u socket | -p port [-h host])" << " [-c connections] [-n requests] [-x]" << std::endl;
+	std::exit(EXIT_FAILURE);
+}
@@ -2,19 +2,26 @@
 #define DFOREST_H
 
 #include <vector>
+#include <atomic>
 
 #include "dtree.hpp"
 
 namespace dforest
 {
+	class compact_forest;
+
 	class if_forest
 	{
+		friend class compact_forest;
+
 		/*
 		 * Data related private variables.
 		 */
 	private:
 		dtree::dataset _data;
 		int _tree_counts;
+		dtree::splitter _splitter;
+		dsched::scheduler* _scheduler;
 
 		/*
 		 * Trees
@@ -27,8 +34,17 @@ namespace dforest
 		 */
 	public:
 		if_forest(const dtree::dataset& data, const int& tree_counts)
-			: _data(data), _tree_counts(tree_counts)
+			: _data(data), _tree_counts(tree_counts), _splitter(dtree::splitter::exact), _scheduler(NULL)
+		{
+		}
+
+		/*
+		 * Restore a trained forest from the model file written by save().
+		 */
+		if_forest(std::istream& input)
+			: _tree_counts(0), _splitter(dtree::splitter::exact), _scheduler(NULL)
 		{
+			load(input);
 		}
 
 		~if_forest()
@@ -41,8 +57,9 @@ namespace dforest
 		{
 			for (auto& tree : _forest)
 			{
-				tree->destroy_tree();
+				delete tree;
 			}
+			_forest.clear();
 		}
 
 	public:
@@ -51,12 +68,13 @@ namespace dforest
 		 */
 		void regenerate()
 		{
-			_forest.clear();
+			destroy_forest();
 			_forest.reserve(_tree_counts);
 
 			for (int i = 0; i < _tree_counts; i++)
 			{
 				dtree::if_tree* tmp_itree = new dtree::if_tree(_data.get_partial_data(3), 0);
+				tmp_itree->set_splitter(_splitter);
 				_forest.push_back(tmp_itree);
 			}
 		}
@@ -65,11 +83,228 @@ namespace dforest
 		 * Use the forest.
 		 */
 		void predict()
+		{
+			dsched::task_group trees(_scheduler);
+			for (auto& t : _forest)
+			{
+				t->set_scheduler(_scheduler);
+				trees.spawn([t]() {
+					t->predict();
+				});
+			}
+			trees.wait();
+		}
+
+		/*
+		 * Trees and their subtrees share the scheduler, NULL keeps the construction sequential.
+		 */
+		void set_scheduler(dsched::scheduler* scheduler)
+		{
+			_scheduler = scheduler;
+		}
+
+		/*
+		 * Threshold search of the trees built by the next regenerate().
+		 */
+		void set_splitter(const dtree::splitter& method)
+		{
+			_splitter = method;
+		}
+
+		/*
+		 * Code generation settings and traffic profile, applied to every trained tree.
+		 */
+		void set_branch_hints(const bool& hints)
 		{
 			for (auto& t : _forest)
 			{
-				t->predict();
+				t->set_branch_hints(hints);
+			}
+		}
+
+		void set_cold_ratio(const double& ratio)
+		{
+			for (auto& t : _forest)
+			{
+				t->set_cold_ratio(ratio);
+			}
+		}
+
+		void set_feature_map(const std::map<int, int>* feature_map)
+		{
+			for (auto& t : _forest)
+			{
+				t->set_feature_map(feature_map);
+			}
+		}
+
+		void profile(const std::vector<std::map<int, double> >& traffic)
+		{
+			for (auto& t : _forest)
+			{
+				t->profile(traffic);
+			}
+		}
+
+		/*
+		 * Pruning passes, applied to every tree.
+		 */
+	public:
+		int get_node_counts() const
+		{
+			int counts = 0;
+			for (const auto& t : _forest)
+			{
+				counts += t->get_node_counts();
+			}
+			return counts;
+		}
+
+		void get_feature_indices(std::set<int>& indices) const
+		{
+			for (const auto& t : _forest)
+			{
+				t->get_feature_indices(indices);
+			}
+		}
+
+		void prune_reduced_error(const dtree::dataset& validation)
+		{
+			for (auto& t : _forest)
+			{
+				t->prune_reduced_error(validation);
+			}
+		}
+
+		void prune_cost_complexity(const double& alpha)
+		{
+			for (auto& t : _forest)
+			{
+				t->prune_cost_complexity(alpha);
+			}
+		}
+
+		void collapse_leaves()
+		{
+			for (auto& t : _forest)
+			{
+				t->collapse_leaves();
+			}
+		}
+
+		/*
+		 * Order the trees by their agreement with the majority vote over the dataset, so the votes of
+		 * the early trees decide most rows. The conclusions are unchanged.
+		 */
+		void reorder(const dtree::dataset& data)
+		{
+			std::vector<double> agreements(_forest.size(), 0);
+			std::vector<int> votes(_forest.size());
+			for (unsigned int i = 0; i < data.size(); i++)
+			{
+				int total = 0;
+				for (unsigned int t = 0; t < _forest.size(); t++)
+				{
+					votes[t] = _forest[t]->classify(data.get_features(i));
+					total += votes[t];
+				}
+				for (unsigned int t = 0; (t < _forest.size()) && (total != 0); t++)
+				{
+					agreements[t] += ((votes[t] > 0) == (total > 0)) ? data.get_weight(i) : 0;
+				}
+			}
+
+			std::vector<int> order(_forest.size());
+			for (unsigned int t = 0; t < order.size(); t++)
+			{
+				order[t] = t;
+			}
+			std::stable_sort(order.begin(), order.end(), [&agreements](const int& lhs, const int& rhs) {
+				return agreements[lhs] > agreements[rhs];
+			});
+
+			std::vector<dtree::if_tree*> reordered;
+			for (const auto& t : order)
+			{
+				reordered.push_back(_forest[t]);
+			}
+			_forest = reordered;
+		}
+
+		/*
+		 * Evaluate the trained forest in-process, ties are broken the same way as forest_predict.
+		 * Evaluation stops once the remaining trees can no longer change the sign of the votes.
+		 */
+	public:
+		int classify(const std::map<int, double>& features) const
+		{
+			int votes = 0;
+			int remain = _forest.size();
+			for (auto itr = _forest.begin(); (itr != _forest.end()) && (std::abs(votes) <= remain); ++itr)
+			{
+				votes += (*itr)->classify(features);
+				remain--;
+			}
+
+			if (votes > 0)
+			{
+				return 1;
+			}
+			else if (votes < 0)
+			{
+				return -1;
+			}
+			else
+			{
+				std::srand(std::time(0));
+				return ((std::rand() % 2) ? 1 : -1);
+			}
+		}
+
+		void classify(const std::vector<std::map<int, double> >& rows, std::vector<int>& conclusions) const
+		{
+			conclusions.resize(rows.size());
+			for (unsigned int i = 0; i < rows.size(); i++)
+			{
+				conclusions[i] = classify(rows[i]);
+			}
+		}
+
+		int get_tree_counts() const
+		{
+			return _tree_counts;
+		}
+
+		/*
+		 * Model serialization, trees are stored back to back after the forest header.
+		 */
+	public:
+		void save(std::ostream& stream) const
+		{
+			stream << "forest " << _forest.size() << std::endl;
+			for (const auto& t : _forest)
+			{
+				t->save(stream);
+			}
+		}
+
+		void load(std::istream& stream)
+		{
+			std::string header;
+			int tree_counts;
+			if (!(stream >> header >> tree_counts) || (header != "forest") || (tree_counts <= 0))
+			{
+				throw std::runtime_error("load(): Missing forest header.");
+				std::exit(EXIT_FAILURE);
 			}
+
+			destroy_forest();
+			_forest.reserve(tree_counts);
+			for (int i = 0; i < tree_counts; i++)
+			{
+				_forest.push_back(new dtree::if_tree(stream));
+			}
+			_tree_counts = tree_counts;
 		}
 
 		/*
@@ -95,9 +330,187 @@ namespace dforest
 			stream << indent_character << "int votes = 0;" << std::endl;
 			for (int i = 0; i < _tree_counts; i++)
 			{
+				int remain = _tree_counts - i - 1;
 				stream << "tree" << (i + 1) << "_predict:" << std::endl;
 				stream << indent_character << "votes += " << "tree" << (i + 1) << "_predict(attr);" << std::endl;
+				if (remain > 0)
+				{
+					stream << indent_character << "if (votes > " << remain << " || votes < -" << remain << ")" << std::endl;
+					stream << indent_character << indent_character << "goto voting;" << std::endl;
+				}
+			}
+			stream << "voting:" << std::endl;
+			stream << indent_character << "if (votes > 0)" << std::endl;
+			stream << indent_character << indent_character << "return 1;" << std::endl;
+			stream << indent_character << "else if (votes < 0)" << std::endl;
+			stream << indent_character << indent_character << "return -1;" << std::endl;
+			stream << indent_character << "else {" << std::endl;
+			stream << indent_character << indent_character << "std::srand(std::time(0));" << std::endl;
+			stream << indent_character << indent_character << "return ((std::rand() % 2) ? 1 : -1);" << std::endl;
+			stream << indent_character << '}' << std::endl;
+			stream << '}' << std::endl;
+		}
+	};
+	/*
+	 * Every tree of the forest flattened into one contiguous node table.
+	 */
+	class compact_forest
+	{
+	private:
+		std::vector<dtree::packed_node> _nodes;
+		std::vector<int> _leaves;
+		std::vector<uint32_t> _roots;
+
+		/*
+		 * Rows scored and trees evaluated for them, the early exit skips the rest.
+		 */
+		mutable std::atomic<long> _evaluated_rows, _evaluated_trees;
+
+		/*
+		 * Constructors
+		 */
+	public:
+		compact_forest(const if_forest& forest, const dtree::layout& order = dtree::layout::hot_path)
+			: _evaluated_rows(0), _evaluated_trees(0)
+		{
+			for (const auto& t : forest._forest)
+			{
+				_roots.push_back(dtree::compact_tree::append(*t, _nodes, _leaves, order));
+			}
+		}
+
+		/*
+		 * Scoring, ties are broken the same way as forest_predict.
+		 * Evaluation stops once |votes| exceeds the number of remaining trees.
+		 */
+	public:
+		template <typename Lookup>
+		int evaluate(Lookup lookup) const
+		{
+			int trees;
+			int conclusion = evaluate(lookup, trees);
+			record(1, trees);
+			return conclusion;
+		}
+
+		template <typename Lookup>
+		int evaluate(Lookup lookup, int& trees) const
+		{
+			int votes = 0;
+			int counts = _roots.size();
+			for (trees = 0; (trees < counts) && (std::abs(votes) <= counts - trees); trees++)
+			{
+				votes += dtree::compact_tree::evaluate(_nodes.data(), _leaves.data(), _roots[trees], lookup);
 			}
+
+			if (votes > 0)
+			{
+				return 1;
+			}
+			else if (votes < 0)
+			{
+				return -1;
+			}
+			else
+			{
+				std::srand(std::time(0));
+				return ((std::rand() % 2) ? 1 : -1);
+			}
+		}
+
+		int classify(const std::map<int, double>& features) const
+		{
+			return evaluate([&features](const uint32_t& feature_index) {
+				auto itr = features.find(feature_index);
+				return (itr != features.end()) ? itr->second : 0.0;
+			});
+		}
+
+		int classify(const double* attr) const
+		{
+			return evaluate([attr](const uint32_t& feature_index) {
+				return attr[feature_index];
+			});
+		}
+
+		void classify(const std::vector<std::map<int, double> >& rows, std::vector<int>& conclusions) const
+		{
+			long total_trees = 0;
+			conclusions.resize(rows.size());
+			for (unsigned int i = 0; i < rows.size(); i++)
+			{
+				const auto& features = rows[i];
+				int trees;
+				conclusions[i] = evaluate([&features](const uint32_t& feature_index) {
+					auto itr = features.find(feature_index);
+					return (itr != features.end()) ? itr->second : 0.0;
+				}, trees);
+				total_trees += trees;
+			}
+			record(rows.size(), total_trees);
+		}
+
+		int get_tree_counts() const
+		{
+			return _roots.size();
+		}
+
+		/*
+		 * Return: average number of trees evaluated per scored row.
+		 */
+		double get_average_trees() const
+		{
+			long rows = _evaluated_rows;
+			return (rows > 0) ? (_evaluated_trees / (double)rows) : 0;
+		}
+
+	private:
+		void record(const long& rows, const long& trees) const
+		{
+			_evaluated_rows += rows;
+			_evaluated_trees += trees;
+		}
+
+	public:
+
+		std::size_t get_node_counts() const
+		{
+			return _nodes.size();
+		}
+
+		std::size_t get_memory_usage() const
+		{
+			return _nodes.size() * sizeof(dtree::packed_node) + _leaves.size() * sizeof(int) + _roots.size() * sizeof(uint32_t);
+		}
+
+		/*
+		 * Generate table-driven code, the same layout as the in-memory representation.
+		 */
+	public:
+		const std::string indent_character = "  ";
+		void generate_file(std::ostream& stream) const
+		{
+			stream << "#include <cstdlib>" << std::endl;
+			stream << "#include <ctime>" << std::endl;
+			stream << std::endl;
+
+			dtree::compact_tree::generate_tables(stream, "forest", _nodes, _leaves);
+			stream << "static const unsigned int forest_roots[] = {";
+			for (unsigned int i = 0; i < _roots.size(); i++)
+			{
+				stream << (i ? ", " : "") << _roots[i] << 'u';
+			}
+			stream << "};" << std::endl;
+			stream << std::endl;
+			dtree::compact_tree::generate_walker(stream, "forest");
+
+			stream << "int forest_predict(double *attr) {" << std::endl;
+			stream << indent_character << "int votes = 0;" << std::endl;
+			stream << indent_character << "for (int i = 0; i < " << _roots.size() << "; i++) {" << std::endl;
+			stream << indent_character << indent_character << "votes += forest_walk(attr, forest_roots[i]);" << std::endl;
+			stream << indent_character << indent_character << "if (votes > " << _roots.size() << " - 1 - i || votes < -(" << _roots.size() << " - 1 - i))" << std::endl;
+			stream << indent_character << indent_character << indent_character << "goto voting;" << std::endl;
+			stream << indent_character << '}' << std::endl;
 			stream << "voting:" << std::endl;
 			stream << indent_character << "if (votes > 0)" << std::endl;
 			stream << indent_character << indent_character << "return 1;" << std::endl;
@@ -0,0 +1,200 @@
+#ifndef DMODEL_H
+#define DMODEL_H
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+
+#include "dtree.hpp"
+#include "dforest.hpp"
+#include "dmodule.hpp"
+
+namespace dmodel
+{
+	/*
+	 * Parse a single LIBSVM line, the leading conclusion is optional for scoring requests.
+	 * Return: whether a conclusion is present in the line.
+	 */
+	inline bool parse_libsvm(const std::string& input, std::map<int, double>& features, int& conclusion)
+	{
+		features.clear();
+		conclusion = 0;
+
+		bool has_conclusion = false;
+		std::stringstream stream(input);
+		std::string element;
+		while (stream >> element)
+		{
+			std::size_t delim = element.find(':');
+			try
+			{
+				if (delim == std::string::npos)
+				{
+					if (has_conclusion || !features.empty())
+					{
+						throw std::invalid_argument(element);
+					}
+					conclusion = std::stoi(element);
+					has_conclusion = true;
+				}
+				else
+				{
+					features[std::stoi(element.substr(0, delim))] = std::stof(element.substr(delim + 1));
+				}
+			}
+			catch (std::logic_error& e)
+			{
+				throw std::invalid_argument("parse_libsvm(): Malformed element \"" + element + "\".");
+				std::exit(EXIT_FAILURE);
+			}
+		}
+		return has_conclusion;
+	}
+
+	/*
+	 * A trained tree or forest restored from the model file, only exposing the scoring interface.
+	 * Scoring runs on the compact representation, the pointer-based tree is discarded after loading.
+	 * A compiled model module (see dmodule) can stand in for the model file.
+	 */
+	class model
+	{
+	private:
+		std::unique_ptr<dtree::compact_tree> _tree;
+		std::unique_ptr<dforest::compact_forest> _forest;
+		std::unique_ptr<dmodule::module> _module;
+
+		/*
+		 * Constructors
+		 */
+	public:
+		model(std::istream& input)
+		{
+			std::streampos begin = input.tellg();
+			std::string kind;
+			if (!(input >> kind))
+			{
+				throw std::runtime_error("model(): Empty model file.");
+				std::exit(EXIT_FAILURE);
+			}
+			input.seekg(begin);
+
+			if (kind == "tree")
+			{
+				dtree::if_tree tree(input);
+				_tree.reset(new dtree::compact_tree(tree));
+			}
+			else if (kind == "forest")
+			{
+				dforest::if_forest forest(input);
+				_forest.reset(new dforest::compact_forest(forest));
+			}
+			else
+			{
+				throw std::runtime_error("model(): Unknown model type \"" + kind + "\".");
+				std::exit(EXIT_FAILURE);
+			}
+		}
+
+		model(const std::string& module_path)
+			: _module(new dmodule::module(module_path))
+		{
+		}
+
+		/*
+		 * Scoring
+		 */
+	public:
+		int classify(const std::map<int, double>& features) const
+		{
+			if (_module)
+			{
+				return _module->classify(features);
+			}
+			return _tree ? _tree->classify(features) : _forest->classify(features);
+		}
+
+		void classify(const std::vector<std::map<int, double> >& rows, std::vector<int>& conclusions) const
+		{
+			if (_module)
+			{
+				_module->classify(rows, conclusions);
+			}
+			else if (_tree)
+			{
+				_tree->classify(rows, conclusions);
+			}
+			else
+			{
+				_forest->classify(rows, conclusions);
+			}
+		}
+
+		std::string describe() const
+		{
+			std::stringstream stream;
+			if (_module)
+			{
+				const dtree_module_info& info = _module->get_info();
+				stream << "module " << info.kind;
+				if (info.trees > 1)
+				{
+					stream << " of " << info.trees << " trees";
+				}
+				return stream.str();
+			}
+			if (_tree)
+			{
+				stream << "tree";
+			}
+			else
+			{
+				stream << "forest of " << _forest->get_tree_counts() << " trees";
+			}
+			stream << " (" << get_memory_usage() << " bytes)";
+			return stream.str();
+		}
+
+		/*
+		 * Return: average trees evaluated per row by a forest, 0 when unknown.
+		 */
+		double get_average_trees() const
+		{
+			return _forest ? _forest->get_average_trees() : 0;
+		}
+
+		std::size_t get_memory_usage() const
+		{
+			if (_module)
+			{
+				return 0;
+			}
+			return _tree ? _tree->get_memory_usage() : _forest->get_memory_usage();
+		}
+	};
+
+	/*
+	 * Paths ending in ".so" are loaded as compiled model modules.
+	 */
+	inline std::shared_ptr<model> load_model(const std::string& path)
+	{
+		const std::string suffix = ".so";
+		if ((path.size() > suffix.size()) && (path.compare(path.size() - suffix.size(), suffix.size(), suffix) == 0))
+		{
+			return std::make_shared<model>(path);
+		}
+
+		std::ifstream input(path);
+		if (!input)
+		{
+			throw std::runtime_error("load_model(): Unable to open \"" + path + "\".");
+			std::exit(EXIT_FAILURE);
+		}
+		return std::make_shared<model>(input);
+	}
+}
+
+#endif
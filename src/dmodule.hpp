@@ -0,0 +1,339 @@
+#ifndef DMODULE_H
+#define DMODULE_H
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <memory>
+#include <limits>
+#include <cstdlib>
+#include <cerrno>
+
+#include <dlfcn.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "dtree.hpp"
+#include "dforest.hpp"
+
+/*
+ * Metadata exported by every model module, shared with the generated code.
+ */
+extern "C" struct dtree_module_info
+{
+	int abi_version;
+	const char* kind;
+	int trees;
+	int feature_counts;
+	const int* feature_indices;
+};
+
+namespace dmodule
+{
+	/*
+	 * Fixed C ABI of a model module. Only the features tested by the model are passed, attr[i] holds the value of
+	 * feature info->feature_indices[i] and is sized info->feature_counts.
+	 *   const dtree_module_info* dtree_info();
+	 *   int dtree_predict(const double* attr);
+	 *   void dtree_predict_batch(const double* attrs, int rows, int stride, int* conclusions);
+	 */
+	const int abi_version = 2;
+
+	/*
+	 * Module source, the generate_file() output followed by the C ABI wrappers.
+	 */
+	template <typename Model>
+	void generate_source(std::ostream& stream, Model& model, const std::string& kind, const int& trees)
+	{
+		// Compact (feature id -> attr index) table, so sparse ids do not blow up the attr arrays.
+		std::set<int> indices;
+		model.get_feature_indices(indices);
+		std::map<int, int> feature_map;
+		for (const auto& index : indices)
+		{
+			feature_map.insert(std::make_pair(index, (int)feature_map.size()));
+		}
+
+		// Thresholds have to round-trip exactly in the compiled code.
+		std::streamsize precision = stream.precision(std::numeric_limits<double>::max_digits10);
+		model.set_feature_map(&feature_map);
+		model.generate_file(stream);
+		model.set_feature_map(NULL);
+		stream.precision(precision);
+
+		std::string entry = kind + "_predict";
+		stream << std::endl;
+		stream << "extern \"C\" struct dtree_module_info {" << std::endl;
+		stream << "  int abi_version;" << std::endl;
+		stream << "  const char *kind;" << std::endl;
+		stream << "  int trees;" << std::endl;
+		stream << "  int feature_counts;" << std::endl;
+		stream << "  const int *feature_indices;" << std::endl;
+		stream << "};" << std::endl;
+		stream << std::endl;
+		if (!feature_map.empty())
+		{
+			stream << "static const int dtree_feature_indices[] = {";
+			for (const auto& feature : feature_map)
+			{
+				stream << ((feature.second > 0) ? ", " : "") << feature.first;
+			}
+			stream << "};" << std::endl;
+			stream << std::endl;
+		}
+		stream << "extern \"C\" const dtree_module_info *dtree_info() {" << std::endl;
+		stream << "  static const dtree_module_info info = {" << abi_version << ", \"" << kind << "\", " << trees << ", "
+			<< feature_map.size() << ", " << (feature_map.empty() ? "0" : "dtree_feature_indices") << "};" << std::endl;
+		stream << "  return &info;" << std::endl;
+		stream << '}' << std::endl;
+		stream << std::endl;
+		stream << "extern \"C\" int dtree_predict(const double *attr) {" << std::endl;
+		stream << "  return " << entry << "(const_cast<double *>(attr));" << std::endl;
+		stream << '}' << std::endl;
+		stream << std::endl;
+		stream << "extern \"C\" void dtree_predict_batch(const double *attrs, int rows, int stride, int *conclusions) {" << std::endl;
+		stream << "  for (int i = 0; i < rows; i++)" << std::endl;
+		stream << "    conclusions[i] = " << entry << "(const_cast<double *>(attrs + (long)i * stride));" << std::endl;
+		stream << '}' << std::endl;
+	}
+
+	inline void generate_source(std::ostream& stream, dtree::if_tree& tree)
+	{
+		generate_source(stream, tree, "tree", 1);
+	}
+
+	inline void generate_source(std::ostream& stream, dforest::if_forest& forest)
+	{
+		generate_source(stream, forest, "forest", forest.get_tree_counts());
+	}
+
+	/*
+	 * Compile the module source with $CXX (or c++) into a shared object.
+	 * The compiler is run without a shell, so the paths are passed as they are.
+	 */
+	inline void build(const std::string& source_path, const std::string& module_path)
+	{
+		const char* compiler = std::getenv("CXX");
+		std::vector<std::string> arguments = { (compiler != NULL) ? compiler : "c++", "-std=c++11", "-O2", "-shared", "-fPIC",
+			"-o", module_path, source_path };
+		std::vector<char*> argv;
+		for (auto& argument : arguments)
+		{
+			argv.push_back(&argument[0]);
+		}
+		argv.push_back(NULL);
+
+		pid_t pid = ::fork();
+		if (pid < 0)
+		{
+			throw std::runtime_error("build(): Unable to run the compiler.");
+			std::exit(EXIT_FAILURE);
+		}
+		if (pid == 0)
+		{
+			::execvp(argv[0], argv.data());
+			::_exit(127);
+		}
+
+		int status;
+		while (::waitpid(pid, &status, 0) < 0)
+		{
+			if (errno != EINTR)
+			{
+				throw std::runtime_error("build(): Unable to wait for the compiler.");
+				std::exit(EXIT_FAILURE);
+			}
+		}
+		if (!WIFEXITED(status) || (WEXITSTATUS(status) != 0))
+		{
+			throw std::runtime_error("build(): Failed to compile \"" + source_path + "\".");
+			std::exit(EXIT_FAILURE);
+		}
+	}
+
+	template <typename Model>
+	void build_module(Model& model, const std::string& module_path)
+	{
+		std::string source_path = module_path + ".cpp";
+		std::ofstream source(source_path);
+		generate_source(source, model);
+		source.close();
+
+		build(source_path, module_path);
+	}
+
+	/*
+	 * A loaded model module, unloaded by the destructor.
+	 * Hold it through a shared_ptr so in-flight batches keep the old module alive across a swap.
+	 */
+	class module
+	{
+		typedef const dtree_module_info* (*info_function)();
+		typedef int (*predict_function)(const double*);
+		typedef void (*predict_batch_function)(const double*, int, int, int*);
+
+	private:
+		void* _handle;
+		const dtree_module_info* _info;
+		predict_function _predict;
+		predict_batch_function _predict_batch;
+
+		// (feature id -> attr index)
+		std::unordered_map<int, int> _feature_map;
+
+		/*
+		 * Constructors and destructors
+		 */
+	public:
+		module(const std::string& path)
+		{
+			// dlopen() hands back the loaded handle for a path it has seen, so a module rebuilt in place
+			// is loaded from a private copy. The copy is unlinked once mapped.
+			std::string target = copy(path);
+			_handle = ::dlopen(target.c_str(), RTLD_NOW | RTLD_LOCAL);
+			::unlink(target.c_str());
+			if (_handle == NULL)
+			{
+				throw std::runtime_error(std::string("module(): ") + ::dlerror());
+				std::exit(EXIT_FAILURE);
+			}
+
+			info_function info = (info_function)::dlsym(_handle, "dtree_info");
+			_predict = (predict_function)::dlsym(_handle, "dtree_predict");
+			_predict_batch = (predict_batch_function)::dlsym(_handle, "dtree_predict_batch");
+			if ((info == NULL) || (_predict == NULL) || (_predict_batch == NULL))
+			{
+				::dlclose(_handle);
+				throw std::runtime_error("module(): \"" + path + "\" does not export the model ABI.");
+				std::exit(EXIT_FAILURE);
+			}
+
+			_info = info();
+			if (_info->abi_version != abi_version)
+			{
+				::dlclose(_handle);
+				throw std::runtime_error("module(): \"" + path + "\" was built for another ABI version.");
+				std::exit(EXIT_FAILURE);
+			}
+
+			for (int i = 0; i < _info->feature_counts; i++)
+			{
+				_feature_map[_info->feature_indices[i]] = i;
+			}
+		}
+
+		~module()
+		{
+			::dlclose(_handle);
+		}
+
+		module(const module&) = delete;
+		module& operator=(const module&) = delete;
+
+	private:
+		/*
+		 * Return: unique path of a copy next to the module.
+		 */
+		static std::string copy(const std::string& path)
+		{
+			std::ifstream source(path, std::ios::binary);
+			if (!source)
+			{
+				throw std::runtime_error("module(): Unable to open \"" + path + "\".");
+				std::exit(EXIT_FAILURE);
+			}
+
+			// Without a slash dlopen() would search the library path instead.
+			std::string pattern = ((path.find('/') == std::string::npos) ? ("./" + path) : path) + ".XXXXXX";
+			std::vector<char> target(pattern.begin(), pattern.end());
+			target.push_back('\0');
+			int fd = ::mkstemp(target.data());
+			if (fd < 0)
+			{
+				throw std::runtime_error("module(): Unable to create a copy of \"" + path + "\".");
+				std::exit(EXIT_FAILURE);
+			}
+			::close(fd);
+
+			std::ofstream destination(target.data(), std::ios::binary | std::ios::trunc);
+			destination << source.rdbuf();
+			destination.close();
+			if (!destination)
+			{
+				::unlink(target.data());
+				throw std::runtime_error("module(): Unable to copy \"" + path + "\".");
+				std::exit(EXIT_FAILURE);
+			}
+			return std::string(target.data());
+		}
+
+		/*
+		 * Scoring
+		 */
+	public:
+		const dtree_module_info& get_info() const
+		{
+			return *_info;
+		}
+
+		int predict(const double* attr) const
+		{
+			return _predict(attr);
+		}
+
+		void predict(const double* attrs, const int& rows, const int& stride, int* conclusions) const
+		{
+			_predict_batch(attrs, rows, stride, conclusions);
+		}
+
+		/*
+		 * Sparse rows are scattered into attr arrays over the tested features only, the others are dropped.
+		 */
+		int classify(const std::map<int, double>& features) const
+		{
+			static thread_local std::vector<double> attr;
+			scatter(features, attr, 0);
+			return _predict(attr.data());
+		}
+
+		void classify(const std::vector<std::map<int, double> >& rows, std::vector<int>& conclusions) const
+		{
+			static thread_local std::vector<double> attrs;
+			int stride = std::max(1, _info->feature_counts);
+			attrs.assign(rows.size() * stride, 0);
+			for (std::size_t i = 0; i < rows.size(); i++)
+			{
+				scatter(rows[i], attrs, i * stride);
+			}
+
+			conclusions.resize(rows.size());
+			_predict_batch(attrs.data(), rows.size(), stride, conclusions.data());
+		}
+
+	private:
+		void scatter(const std::map<int, double>& features, std::vector<double>& attrs, const std::size_t& offset) const
+		{
+			int stride = std::max(1, _info->feature_counts);
+			if (attrs.size() < offset + stride)
+			{
+				attrs.resize(offset + stride);
+			}
+			std::fill(attrs.begin() + offset, attrs.begin() + offset + stride, 0);
+			for (const auto& feature : features)
+			{
+				auto itr = _feature_map.find(feature.first);
+				if (itr != _feature_map.end())
+				{
+					attrs[offset + itr->second] = feature.second;
+				}
+			}
+		}
+	};
+
+}
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef DPIPE_H
+#define DPIPE_H
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+namespace dpipe
+{
+	/*
+	 * Blocking FIFO with a fixed capacity, connecting two pipeline stages.
+	 * Producers block while it is full, consumers block while it is empty and not closed.
+	 */
+	template <typename T>
+	class bounded_queue
+	{
+	private:
+		std::deque<T> _items;
+		std::size_t _capacity;
+		bool _closed;
+		std::mutex _lock;
+		std::condition_variable _not_empty, _not_full;
+
+		/*
+		 * Constructors
+		 */
+	public:
+		bounded_queue(const std::size_t& capacity)
+			: _capacity(capacity), _closed(false)
+		{
+		}
+
+		/*
+		 * Queue operations.
+		 */
+	public:
+		void push(T item)
+		{
+			std::unique_lock<std::mutex> guard(_lock);
+			_not_full.wait(guard, [this] { return _closed || (_items.size() < _capacity); });
+			_items.push_back(std::move(item));
+			_not_empty.notify_one();
+		}
+
+		/*
+		 * Return: false once the queue is closed and drained.
+		 */
+		bool pop(T& item)
+		{
+			std::unique_lock<std::mutex> guard(_lock);
+			_not_empty.wait(guard, [this] { return _closed || !_items.empty(); });
+			if (_items.empty())
+			{
+				return false;
+			}
+			item = std::move(_items.front());
+			_items.pop_front();
+			_not_full.notify_one();
+			return true;
+		}
+
+		/*
+		 * No more items will be pushed, pending ones are still delivered.
+		 */
+		void close()
+		{
+			std::lock_guard<std::mutex> guard(_lock);
+			_closed = true;
+			_not_empty.notify_all();
+			_not_full.notify_all();
+		}
+	};
+}
+
+#endif
@@ -0,0 +1,237 @@
+#ifndef DSCHED_H
+#define DSCHED_H
+
+#include <vector>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <exception>
+
+namespace dsched
+{
+	/*
+	 * Work-stealing scheduler, every worker owns a deque it pops from the back (LIFO),
+	 * idle workers steal from the front (FIFO) of the others. Threads waiting on a task_group
+	 * keep executing tasks, so nested spawning never blocks a worker.
+	 */
+	class scheduler
+	{
+		struct queue
+		{
+			std::deque<std::function<void()> > tasks;
+			std::mutex lock;
+		};
+
+	private:
+		std::vector<std::unique_ptr<queue> > _queues;
+		std::vector<std::thread> _workers;
+		std::atomic<int> _pending;
+		std::atomic<bool> _stopped;
+		std::mutex _idle_lock;
+		std::condition_variable _idle;
+
+		/*
+		 * Queue owned by the calling thread, the last one is shared by external threads.
+		 */
+		static int& current_index()
+		{
+			static thread_local int index = -1;
+			return index;
+		}
+
+		/*
+		 * Constructors and destructors
+		 */
+	public:
+		scheduler(const int& threads)
+			: _pending(0), _stopped(false)
+		{
+			int workers_counts = (threads > 1) ? (threads - 1) : 0;
+			for (int i = 0; i <= workers_counts; i++)
+			{
+				_queues.push_back(std::unique_ptr<queue>(new queue));
+			}
+			for (int i = 0; i < workers_counts; i++)
+			{
+				_workers.push_back(std::thread(&scheduler::work, this, i));
+			}
+		}
+
+		~scheduler()
+		{
+			_stopped = true;
+			_idle.notify_all();
+			for (auto& worker : _workers)
+			{
+				worker.join();
+			}
+		}
+
+		int get_thread_counts() const
+		{
+			return _workers.size() + 1;
+		}
+
+		/*
+		 * Task operations.
+		 */
+	public:
+		void spawn(const std::function<void()>& task)
+		{
+			int index = current_index();
+			queue& target = *_queues[(index < 0) ? (_queues.size() - 1) : index];
+			{
+				std::lock_guard<std::mutex> guard(target.lock);
+				target.tasks.push_back(task);
+			}
+			_pending++;
+			_idle.notify_one();
+		}
+
+		/*
+		 * Run one pending task on the calling thread.
+		 * Return: whether a task was found.
+		 */
+		bool run_one()
+		{
+			std::function<void()> task;
+			if (!take(task))
+			{
+				return false;
+			}
+			task();
+			return true;
+		}
+
+	private:
+		bool take(std::function<void()>& task)
+		{
+			int index = current_index();
+			int own = (index < 0) ? (_queues.size() - 1) : index;
+
+			// Own queue from the back.
+			{
+				queue& target = *_queues[own];
+				std::lock_guard<std::mutex> guard(target.lock);
+				if (!target.tasks.empty())
+				{
+					task = std::move(target.tasks.back());
+					target.tasks.pop_back();
+					_pending--;
+					return true;
+				}
+			}
+
+			// Steal from the others from the front.
+			for (unsigned int i = 1; i < _queues.size(); i++)
+			{
+				queue& target = *_queues[(own + i) % _queues.size()];
+				std::lock_guard<std::mutex> guard(target.lock);
+				if (!target.tasks.empty())
+				{
+					task = std::move(target.tasks.front());
+					target.tasks.pop_front();
+					_pending--;
+					return true;
+				}
+			}
+			return false;
+		}
+
+		void work(int index)
+		{
+			current_index() = index;
+			while (!_stopped)
+			{
+				if (!run_one())
+				{
+					std::unique_lock<std::mutex> guard(_idle_lock);
+					_idle.wait_for(guard, std::chrono::milliseconds(1), [this] { return _stopped || (_pending > 0); });
+				}
+			}
+		}
+	};
+
+	/*
+	 * A set of spawned tasks that can be waited on, the first exception is rethrown by wait().
+	 */
+	class task_group
+	{
+	private:
+		scheduler* _scheduler;
+		std::atomic<int> _running;
+		std::exception_ptr _error;
+		std::mutex _error_lock;
+
+	public:
+		task_group(scheduler* s)
+			: _scheduler(s), _running(0)
+		{
+		}
+
+		~task_group()
+		{
+			while (_running > 0)
+			{
+				if (!_scheduler->run_one())
+				{
+					std::this_thread::yield();
+				}
+			}
+		}
+
+		/*
+		 * Run inline when there is no scheduler to hand the task to.
+		 */
+		void spawn(const std::function<void()>& task)
+		{
+			if (_scheduler == NULL)
+			{
+				task();
+				return;
+			}
+
+			_running++;
+			_scheduler->spawn([this, task]() {
+				try
+				{
+					task();
+				}
+				catch (...)
+				{
+					std::lock_guard<std::mutex> guard(_error_lock);
+					if (!_error)
+					{
+						_error = std::current_exception();
+					}
+				}
+				_running--;
+			});
+		}
+
+		void wait()
+		{
+			while (_running > 0)
+			{
+				if (!_scheduler->run_one())
+				{
+					std::this_thread::yield();
+				}
+			}
+
+			if (_error)
+			{
+				std::exception_ptr error = _error;
+				_error = nullptr;
+				std::rethrow_exception(error);
+			}
+		}
+	};
+}
+
+#endif
@@ -0,0 +1,752 @@
+#ifndef DSERVE_H
+#define DSERVE_H
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "dmodel.hpp"
+
+namespace dserve
+{
+	/*
+	 * Wire format
+	 *   text:   one LIBSVM line per request, answered by the conclusion and a newline.
+	 *           Lines starting with '#' are commands ("#stats", "#reload", "#model").
+	 *           "#reload" only re-reads the configured model path, clients can not name a file to load.
+	 *   binary: frame_marker, uint32 counts, counts * (int32 feature_index, double value),
+	 *           answered by an int32 conclusion. Native byte order.
+	 * A line longer than max_line_length or a frame over max_frame_counts closes the connection.
+	 */
+	const unsigned char frame_marker = 0x00;
+	const std::size_t max_line_length = 1 << 20;
+	const uint32_t max_frame_counts = 1 << 16;
+
+	/*
+	 * Socket helpers, all of them return a file descriptor or -1.
+	 */
+	inline int listen_unix(const std::string& path)
+	{
+		sockaddr_un address;
+		if (path.size() >= sizeof(address.sun_path))
+		{
+			return -1;
+		}
+
+		int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0)
+		{
+			return -1;
+		}
+
+		std::memset(&address, 0, sizeof(address));
+		address.sun_family = AF_UNIX;
+		std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+		::unlink(path.c_str());
+
+		if ((::bind(fd, (sockaddr*)&address, sizeof(address)) < 0) || (::listen(fd, SOMAXCONN) < 0))
+		{
+			::close(fd);
+			return -1;
+		}
+		return fd;
+	}
+
+	/*
+	 * Listen on the given IPv4 address, loopback by default since the protocol is unauthenticated.
+	 */
+	inline int listen_tcp(const int& port, const std::string& host = "127.0.0.1")
+	{
+		sockaddr_in address;
+		std::memset(&address, 0, sizeof(address));
+		address.sin_family = AF_INET;
+		address.sin_port = htons(port);
+		if (::inet_pton(AF_INET, host.c_str(), &address.sin_addr) != 1)
+		{
+			return -1;
+		}
+
+		int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+		if (fd < 0)
+		{
+			return -1;
+		}
+
+		int enable = 1;
+		::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+		if ((::bind(fd, (sockaddr*)&address, sizeof(address)) < 0) || (::listen(fd, SOMAXCONN) < 0))
+		{
+			::close(fd);
+			return -1;
+		}
+		return fd;
+	}
+
+	inline int connect_unix(const std::string& path)
+	{
+		sockaddr_un address;
+		if (path.size() >= sizeof(address.sun_path))
+		{
+			return -1;
+		}
+
+		int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0)
+		{
+			return -1;
+		}
+
+		std::memset(&address, 0, sizeof(address));
+		address.sun_family = AF_UNIX;
+		std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+
+		if (::connect(fd, (sockaddr*)&address, sizeof(address)) < 0)
+		{
+			::close(fd);
+			return -1;
+		}
+		return fd;
+	}
+
+	inline int connect_tcp(const std::string& host, const int& port)
+	{
+		addrinfo hints, *result;
+		std::memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_INET;
+		hints.ai_socktype = SOCK_STREAM;
+		if (::getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &result) != 0)
+		{
+			return -1;
+		}
+
+		int fd = ::socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+		if ((fd >= 0) && (::connect(fd, result->ai_addr, result->ai_addrlen) < 0))
+		{
+			::close(fd);
+			fd = -1;
+		}
+		::freeaddrinfo(result);
+
+		if (fd >= 0)
+		{
+			int enable = 1;
+			::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+		}
+		return fd;
+	}
+
+	/*
+	 * Buffered stream over a connected socket, owns the file descriptor.
+	 */
+	class connection
+	{
+	private:
+		int _fd;
+		char _buffer[4096];
+		std::size_t _begin, _end;
+
+	public:
+		connection(const int& fd)
+			: _fd(fd), _begin(0), _end(0)
+		{
+		}
+
+		~connection()
+		{
+			::close(_fd);
+		}
+
+	private:
+		bool fill()
+		{
+			if (_begin < _end)
+			{
+				return true;
+			}
+
+			ssize_t counts;
+			do
+			{
+				counts = ::read(_fd, _buffer, sizeof(_buffer));
+			} while ((counts < 0) && (errno == EINTR));
+
+			if (counts <= 0)
+			{
+				return false;
+			}
+			_begin = 0;
+			_end = counts;
+			return true;
+		}
+
+	public:
+		bool peek(unsigned char& c)
+		{
+			if (!fill())
+			{
+				return false;
+			}
+			c = _buffer[_begin];
+			return true;
+		}
+
+		bool read_line(std::string& line)
+		{
+			line.clear();
+			while (fill())
+			{
+				char* begin = _buffer + _begin;
+				char* newline = (char*)std::memchr(begin, '\n', _end - _begin);
+				if (newline != NULL)
+				{
+					line.append(begin, newline);
+					_begin += (newline - begin) + 1;
+					if (line.size() > max_line_length)
+					{
+						return false;
+					}
+					if (!line.empty() && (line.back() == '\r'))
+					{
+						line.pop_back();
+					}
+					return true;
+				}
+				line.append(begin, _end - _begin);
+				_begin = _end;
+				if (line.size() > max_line_length)
+				{
+					return false;
+				}
+			}
+			return false;
+		}
+
+		bool read_exact(void* output, std::size_t size)
+		{
+			char* target = (char*)output;
+			while (size > 0)
+			{
+				if (!fill())
+				{
+					return false;
+				}
+				std::size_t counts = std::min(size, _end - _begin);
+				std::memcpy(target, _buffer + _begin, counts);
+				_begin += counts;
+				target += counts;
+				size -= counts;
+			}
+			return true;
+		}
+
+		bool write_all(const void* input, std::size_t size)
+		{
+			const char* source = (const char*)input;
+			while (size > 0)
+			{
+				ssize_t counts = ::send(_fd, source, size, MSG_NOSIGNAL);
+				if (counts < 0)
+				{
+					if (errno == EINTR)
+					{
+						continue;
+					}
+					return false;
+				}
+				source += counts;
+				size -= counts;
+			}
+			return true;
+		}
+
+		bool write_all(const std::string& input)
+		{
+			return write_all(input.data(), input.size());
+		}
+	};
+
+	/*
+	 * Binary framing helpers, the marker byte is consumed by read_frame().
+	 */
+	inline void encode_frame(const std::map<int, double>& features, std::string& frame)
+	{
+		uint32_t counts = features.size();
+		frame.assign(1, (char)frame_marker);
+		frame.append((const char*)&counts, sizeof(counts));
+		for (const auto& feature : features)
+		{
+			int32_t feature_index = feature.first;
+			double value = feature.second;
+			frame.append((const char*)&feature_index, sizeof(feature_index));
+			frame.append((const char*)&value, sizeof(value));
+		}
+	}
+
+	inline bool read_frame(connection& stream, std::map<int, double>& features)
+	{
+		unsigned char marker;
+		uint32_t counts;
+		if (!stream.read_exact(&marker, sizeof(marker)) || (marker != frame_marker) || !stream.read_exact(&counts, sizeof(counts))
+			|| (counts > max_frame_counts))
+		{
+			return false;
+		}
+
+		features.clear();
+		for (uint32_t i = 0; i < counts; i++)
+		{
+			int32_t feature_index;
+			double value;
+			if (!stream.read_exact(&feature_index, sizeof(feature_index)) || !stream.read_exact(&value, sizeof(value)))
+			{
+				return false;
+			}
+			features[feature_index] = value;
+		}
+		return true;
+	}
+
+	/*
+	 * Latency and throughput counters, percentiles and rows/s are taken over the most recent samples,
+	 * so idle time before them does not dilute the throughput.
+	 */
+	class latency_stats
+	{
+		typedef std::chrono::steady_clock::time_point time_point;
+
+		// Earliest arrival and completion of a batch.
+		struct batch_span
+		{
+			time_point begin, end;
+			std::size_t rows;
+		};
+
+	private:
+		const std::size_t _capacity = 1 << 16;
+		std::vector<double> _samples;
+		std::size_t _next;
+		unsigned long long _requests, _batches;
+		std::deque<batch_span> _spans;
+		std::size_t _span_rows;
+		mutable std::mutex _lock;
+
+	public:
+		latency_stats()
+			: _next(0), _requests(0), _batches(0), _span_rows(0)
+		{
+			_samples.reserve(_capacity);
+		}
+
+		void record_batch(const std::vector<double>& latencies)
+		{
+			auto now = std::chrono::steady_clock::now();
+			double longest = latencies.empty() ? 0 : *std::max_element(latencies.begin(), latencies.end());
+			batch_span span = { now - std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double, std::micro>(longest)),
+				now, latencies.size() };
+
+			std::lock_guard<std::mutex> guard(_lock);
+			_spans.push_back(span);
+			_span_rows += span.rows;
+			while (_span_rows - _spans.front().rows >= _capacity)
+			{
+				_span_rows -= _spans.front().rows;
+				_spans.pop_front();
+			}
+			for (const auto& latency : latencies)
+			{
+				if (_samples.size() < _capacity)
+				{
+					_samples.push_back(latency);
+				}
+				else
+				{
+					_samples[_next] = latency;
+					_next = (_next + 1) % _capacity;
+				}
+			}
+			_requests += latencies.size();
+			_batches++;
+		}
+
+		std::string report() const
+		{
+			std::vector<double> samples;
+			unsigned long long requests, batches;
+			std::size_t span_rows;
+			double elapsed = 0;
+			{
+				std::lock_guard<std::mutex> guard(_lock);
+				samples = _samples;
+				requests = _requests;
+				batches = _batches;
+				span_rows = _span_rows;
+
+				// Workers complete out of order, the window spans the earliest arrival to the latest completion.
+				if (!_spans.empty())
+				{
+					time_point begin = _spans.front().begin, end = _spans.front().end;
+					for (const auto& span : _spans)
+					{
+						begin = std::min(begin, span.begin);
+						end = std::max(end, span.end);
+					}
+					elapsed = std::chrono::duration<double>(end - begin).count();
+				}
+			}
+
+			std::sort(samples.begin(), samples.end());
+
+			std::stringstream stream;
+			stream << std::fixed << std::setprecision(1);
+			stream << "requests=" << requests;
+			stream << " batches=" << batches;
+			stream << " avg_batch=" << (batches ? (double)requests / batches : 0);
+			stream << " p50_us=" << percentile(samples, 0.50);
+			stream << " p99_us=" << percentile(samples, 0.99);
+			stream << " rows_per_s=" << (elapsed > 0 ? span_rows / elapsed : 0);
+			return stream.str();
+		}
+
+		static double percentile(const std::vector<double>& sorted, const double& ratio)
+		{
+			if (sorted.empty())
+			{
+				return 0;
+			}
+			std::size_t index = std::min(sorted.size() - 1, (std::size_t)(ratio * sorted.size()));
+			return sorted[index];
+		}
+	};
+
+	/*
+	 * Prediction server, requests from every connection are coalesced into micro-batches
+	 * and scored by a fixed pool of workers against the current model snapshot.
+	 */
+	class server
+	{
+		struct request
+		{
+			std::map<int, double> features;
+			std::promise<int> conclusion;
+			std::chrono::steady_clock::time_point arrival;
+		};
+
+	private:
+		std::shared_ptr<dmodel::model> _model;
+		std::string _model_path;
+		std::mutex _model_lock;
+
+		/*
+		 * Batching related private variables.
+		 */
+	private:
+		int _workers_counts;
+		std::size_t _max_batch;
+		std::chrono::microseconds _max_delay;
+		std::deque<request*> _queue;
+		std::mutex _queue_lock;
+		std::condition_variable _queue_ready;
+		std::vector<std::thread> _workers;
+		bool _stopped;
+
+		latency_stats _stats;
+
+		/*
+		 * Constructors and destructors
+		 */
+	public:
+		server(const std::string& model_path, const int& workers_counts, const int& max_batch, const int& max_delay_us)
+			: _model_path(model_path), _workers_counts(workers_counts), _max_batch(max_batch), _max_delay(max_delay_us), _stopped(false)
+		{
+			_model = dmodel::load_model(model_path);
+		}
+
+		~server()
+		{
+			stop();
+		}
+
+		/*
+		 * Worker pool management.
+		 */
+	public:
+		void start()
+		{
+			for (int i = 0; i < _workers_counts; i++)
+			{
+				_workers.push_back(std::thread(&server::work, this));
+			}
+		}
+
+		void stop()
+		{
+			{
+				std::lock_guard<std::mutex> guard(_queue_lock);
+				_stopped = true;
+			}
+			_queue_ready.notify_all();
+
+			for (auto& worker : _workers)
+			{
+				worker.join();
+			}
+			_workers.clear();
+		}
+
+	private:
+		void work()
+		{
+			std::vector<request*> batch;
+			std::vector<std::map<int, double> > rows;
+			std::vector<int> conclusions;
+			std::vector<double> latencies;
+
+			while (true)
+			{
+				batch.clear();
+				{
+					std::unique_lock<std::mutex> guard(_queue_lock);
+					_queue_ready.wait(guard, [this] { return _stopped || !_queue.empty(); });
+					if (_queue.empty())
+					{
+						return;
+					}
+
+					// Give concurrent requests a short window to join the batch.
+					if (_queue.size() < _max_batch)
+					{
+						auto deadline = _queue.front()->arrival + _max_delay;
+						_queue_ready.wait_until(guard, deadline, [this] { return _stopped || (_queue.size() >= _max_batch); });
+					}
+					while (!_queue.empty() && (batch.size() < _max_batch))
+					{
+						batch.push_back(_queue.front());
+						_queue.pop_front();
+					}
+				}
+				if (batch.empty())
+				{
+					continue;
+				}
+
+				// In-flight batches keep their own reference, so a swap never drops them.
+				std::shared_ptr<dmodel::model> snapshot = std::atomic_load(&_model);
+
+				rows.resize(batch.size());
+				for (std::size_t i = 0; i < batch.size(); i++)
+				{
+					rows[i].swap(batch[i]->features);
+				}
+				snapshot->classify(rows, conclusions);
+
+				auto now = std::chrono::steady_clock::now();
+				latencies.resize(batch.size());
+				for (std::size_t i = 0; i < batch.size(); i++)
+				{
+					latencies[i] = std::chrono::duration<double, std::micro>(now - batch[i]->arrival).count();
+					batch[i]->conclusion.set_value(conclusions[i]);
+				}
+				_stats.record_batch(latencies);
+			}
+		}
+
+		/*
+		 * Request submission and model swapping.
+		 */
+	private:
+		std::future<int> submit(request& slot)
+		{
+			slot.arrival = std::chrono::steady_clock::now();
+			std::future<int> result = slot.conclusion.get_future();
+
+			bool filled;
+			{
+				std::lock_guard<std::mutex> guard(_queue_lock);
+				_queue.push_back(&slot);
+				filled = (_queue.size() >= _max_batch);
+			}
+			if (filled)
+			{
+				_queue_ready.notify_all();
+			}
+			else
+			{
+				_queue_ready.notify_one();
+			}
+			return result;
+		}
+
+	public:
+		/*
+		 * Blocks the calling connection until its micro-batch is scored.
+		 */
+		int classify(std::map<int, double>& features)
+		{
+			request slot;
+			slot.features.swap(features);
+			return submit(slot).get();
+		}
+
+		/*
+		 * Re-read the model path given at startup, replace that file to roll out a new model.
+		 */
+		std::string reload()
+		{
+			std::lock_guard<std::mutex> guard(_model_lock);
+			try
+			{
+				std::shared_ptr<dmodel::model> replacement = dmodel::load_model(_model_path);
+				std::atomic_store(&_model, replacement);
+				return "ok " + replacement->describe();
+			}
+			catch (std::exception& e)
+			{
+				return std::string("error ") + e.what();
+			}
+		}
+
+		std::string describe()
+		{
+			return std::atomic_load(&_model)->describe();
+		}
+
+		std::string report() const
+		{
+			return _stats.report();
+		}
+
+		/*
+		 * Connection handling, one thread per connection only does I/O.
+		 */
+	public:
+		void serve(const int& listen_fd)
+		{
+			while (true)
+			{
+				int fd = ::accept(listen_fd, NULL, NULL);
+				if (fd < 0)
+				{
+					if ((errno == EINTR) || (errno == ECONNABORTED))
+					{
+						continue;
+					}
+					break;
+				}
+				std::thread(&server::handle, this, fd).detach();
+			}
+		}
+
+	private:
+		void handle(int fd)
+		{
+			connection stream(fd);
+			std::map<int, double> features;
+			std::string line;
+			int conclusion;
+
+			unsigned char c;
+			while (stream.peek(c))
+			{
+				if (c == frame_marker)
+				{
+					if (!read_frame(stream, features))
+					{
+						return;
+					}
+
+					int32_t result = classify(features);
+					if (!stream.write_all(&result, sizeof(result)))
+					{
+						return;
+					}
+					continue;
+				}
+
+				if (!stream.read_line(line))
+				{
+					return;
+				}
+
+				std::string response;
+				if (line.empty())
+				{
+					continue;
+				}
+				else if (line[0] == '#')
+				{
+					response = command(line) + '\n';
+				}
+				else
+				{
+					try
+					{
+						dmodel::parse_libsvm(line, features, conclusion);
+						response = std::to_string(classify(features)) + '\n';
+					}
+					catch (std::invalid_argument& e)
+					{
+						response = std::string("error ") + e.what() + '\n';
+					}
+				}
+
+				if (!stream.write_all(response))
+				{
+					return;
+				}
+			}
+		}
+
+		std::string command(const std::string& line)
+		{
+			std::stringstream stream(line.substr(1));
+			std::string name, argument;
+			stream >> name >> argument;
+
+			if (name == "stats")
+			{
+				return report();
+			}
+			else if (name == "reload")
+			{
+				if (!argument.empty())
+				{
+					return "error reload takes no argument";
+				}
+				return reload();
+			}
+			else if (name == "model")
+			{
+				return describe();
+			}
+			else
+			{
+				return "error unknown command \"" + name + "\"";
+			}
+		}
+	};
+}
+
+#endif
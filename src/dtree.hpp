@@ -17,6 +17,11 @@
 #include <ctime>
 #include <queue>
 #include <random>
+#include <memory>
+#include <unordered_map>
+#include <cstdint>
+
+#include "dsched.hpp"
 
 
 namespace dtree
@@ -24,38 +29,72 @@ namespace dtree
 	class dataset
 	{
 		/*
-		 * ((feature_id, data), conclusion)
+		 * Value of an entry in a feature bundle, slot is the position of the original feature in the bundle.
+		 * Sorting by (slot, value) lays the features of a bundle out in consecutive ranges, as offset-encoded values.
+		 */
+		struct bundled_value
+		{
+			int bundle, slot;
+			double value;
+		};
+
+		/*
+		 * ((feature_id, data), conclusion, weight)
+		 * Identical entries are merged by the loader, the weight is the number of merged rows.
+		 * bundled is the same row over the feature bundles, filled once bundle() is called.
 		 */
 		struct entry
 		{
 			std::map<int, double> features;
 			int conclusion;
+			double weight;
+			std::vector<bundled_value> bundled;
 
-			entry() : conclusion(0)
+			entry() : conclusion(0), weight(1)
 			{
 			}
 		};
 
-		struct range
+		struct entry_hash
 		{
-			int min, max;
-
-			range()
+			std::size_t operator()(const entry& e) const
 			{
-				reset();
+				std::size_t seed = std::hash<int>()(e.conclusion);
+				for (const auto& feature : e.features)
+				{
+					seed ^= std::hash<int>()(feature.first) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+					seed ^= std::hash<double>()(feature.second) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+				}
+				return seed;
 			}
+		};
 
-			void reset()
+		struct entry_equal
+		{
+			bool operator()(const entry& lhs, const entry& rhs) const
 			{
-				min = std::numeric_limits<int>::max();
-				max = std::numeric_limits<int>::min();
+				return (lhs.conclusion == rhs.conclusion) && (lhs.features == rhs.features);
 			}
 		};
 
+		/*
+		 * Every feature id seen by the loader, (dense index -> feature id) and (feature id -> dense index).
+		 * Shared by all the subsets derived from the loaded dataset.
+		 */
+		struct dictionary
+		{
+			std::vector<int> ids;
+			std::unordered_map<int, int> dense;
+
+			// (bundle -> feature ids in slot order), empty until bundle() is called.
+			std::vector<std::vector<int> > bundles;
+		};
+
 	private:
 		std::vector<entry> _data;
 		double _confusion;
-		range _feature_range;
+		std::shared_ptr<const dictionary> _dictionary;
+		std::vector<int> _active_features;
 		/*
 		 * Constructors
 		 */
@@ -66,12 +105,26 @@ namespace dtree
 
 		dataset(std::ifstream& input)
 		{
+			// Entry -> index in _data, duplicated rows only increase the weight of the first one.
+			std::unordered_map<entry, std::size_t, entry_hash, entry_equal> indices;
+
 			std::string tmp;
 			while (std::getline(input, tmp))
 			{
-				_data.push_back(libsvm_parser(tmp));
+				entry new_entry = libsvm_parser(tmp);
+				auto itr = indices.find(new_entry);
+				if (itr != indices.end())
+				{
+					_data[itr->second].weight += new_entry.weight;
+				}
+				else
+				{
+					indices.insert(std::make_pair(new_entry, _data.size()));
+					_data.push_back(new_entry);
+				}
 			}
 			update_confusion();
+			update_dictionary();
 		}
 
 		/*
@@ -92,15 +145,6 @@ namespace dtree
 					auto tmp = split(element, ':');
 					int feature_index = std::stoi(tmp[0]);
 					new_entry.features.insert(std::make_pair(feature_index, std::stof(tmp[1])));
-
-					if (feature_index > _feature_range.max)
-					{
-						_feature_range.max = feature_index;
-					}
-					else if (feature_index < _feature_range.min)
-					{
-						_feature_range.min = feature_index;
-					}
 				}
 			}
 			return new_entry;
@@ -130,25 +174,10 @@ namespace dtree
 	private:
 		void update_confusion()
 		{
-			int pos_counts = 0, neg_counts = 0;
-			for (const auto& entry : _data)
-			{
-				if (entry.conclusion > 0)
-				{
-					pos_counts++;
-				}
-				else if (entry.conclusion < 0)
-				{
-					neg_counts++;
-				}
-				else
-				{
-					throw std::domain_error("update_confusion(): Undefined conclusion found during the refresh.");
-					std::exit(EXIT_FAILURE);
-				}
-			}
+			auto counts = get_conclusion_counts();
+			double total_counts = std::get<0>(counts) + std::get<1>(counts);
 
-			_confusion = 1 - std::pow((pos_counts / (double)_data.size()), 2) - std::pow((neg_counts / (double)_data.size()), 2);
+			_confusion = 1 - std::pow((std::get<0>(counts) / total_counts), 2) - std::pow((std::get<1>(counts) / total_counts), 2);
 		}
 
 		/*
@@ -189,18 +218,21 @@ namespace dtree
 			return _confusion;
 		}
 
-		std::pair<int, int> get_conclusion_counts() const
+		/*
+		 * Return: weighted (pos_counts, neg_counts)
+		 */
+		std::pair<double, double> get_conclusion_counts() const
 		{
-			int pos_counts = 0, neg_counts = 0;
+			double pos_counts = 0, neg_counts = 0;
 			for (const auto& entry : _data)
 			{
 				if (entry.conclusion > 0)
 				{
-					pos_counts++;
+					pos_counts += entry.weight;
 				}
 				else if (entry.conclusion < 0)
 				{
-					neg_counts++;
+					neg_counts += entry.weight;
 				}
 				else
 				{
@@ -287,34 +319,209 @@ namespace dtree
 				}
 			}
 
+			pos._dictionary = _dictionary;
+			neg._dictionary = _dictionary;
 			pos = pos_container;
 			neg = neg_container;
 		}
 
 		/*
-		 * Confusion related operations for current dataset.
+		 * Feature dictionary and the features present in current dataset.
 		 */
 	public:
-		range get_feature_range() const
+		/*
+		 * Feature ids present in at least one entry, ascending.
+		 */
+		const std::vector<int>& get_active_features() const
+		{
+			return _active_features;
+		}
+
+		std::size_t get_dictionary_size() const
+		{
+			return _dictionary ? _dictionary->ids.size() : 0;
+		}
+
+		int get_dense_index(const int& feature_index) const
+		{
+			auto itr = _dictionary->dense.find(feature_index);
+			return (itr != _dictionary->dense.end()) ? itr->second : -1;
+		}
+
+		/*
+		 * Exclusive feature bundling, greedily merge features that are rarely non-zero in the same entry
+		 * (at most max_conflicts entries per bundle) so the split search scans one column per bundle.
+		 * Features are placed from the most to the least frequent. A conflicting entry keeps the value of
+		 * the feature in the lower slot only, with no conflicts the trained trees are unchanged.
+		 */
+		void bundle(const int& max_conflicts = 0)
+		{
+			if (!_dictionary)
+			{
+				update_dictionary();
+			}
+
+			// Entries of every (dense) feature.
+			std::vector<std::vector<unsigned int> > rows(_dictionary->ids.size());
+			for (unsigned int index = 0; index < _data.size(); index++)
+			{
+				for (const auto& feature : _data[index].features)
+				{
+					rows[_dictionary->dense.at(feature.first)].push_back(index);
+				}
+			}
+
+			std::vector<int> order(rows.size());
+			for (unsigned int i = 0; i < order.size(); i++)
+			{
+				order[i] = i;
+			}
+			std::stable_sort(order.begin(), order.end(), [&rows](const int& lhs, const int& rhs) {
+				return rows[lhs].size() > rows[rhs].size();
+			});
+
+			std::vector<std::vector<int> > bundles;
+			std::vector<std::vector<bool> > used;
+			std::vector<int> conflicts;
+			for (const auto& dense : order)
+			{
+				int target = -1;
+				for (unsigned int b = 0; (b < bundles.size()) && (target < 0); b++)
+				{
+					int counts = conflicts[b];
+					for (auto itr = rows[dense].begin(); (itr != rows[dense].end()) && (counts <= max_conflicts); ++itr)
+					{
+						counts += used[b][*itr];
+					}
+					if (counts <= max_conflicts)
+					{
+						target = b;
+						conflicts[b] = counts;
+					}
+				}
+				if (target < 0)
+				{
+					target = bundles.size();
+					bundles.push_back(std::vector<int>());
+					used.push_back(std::vector<bool>(_data.size(), false));
+					conflicts.push_back(0);
+				}
+
+				bundles[target].push_back(_dictionary->ids[dense]);
+				for (const auto& index : rows[dense])
+				{
+					used[target][index] = true;
+				}
+			}
+
+			// (feature id -> (bundle, slot))
+			std::unordered_map<int, std::pair<int, int> > placement;
+			for (unsigned int b = 0; b < bundles.size(); b++)
+			{
+				for (unsigned int slot = 0; slot < bundles[b].size(); slot++)
+				{
+					placement[bundles[b][slot]] = std::make_pair(b, slot);
+				}
+			}
+
+			for (auto& e : _data)
+			{
+				e.bundled.clear();
+				for (const auto& feature : e.features)
+				{
+					const auto& target = placement.at(feature.first);
+					bundled_value value = { target.first, target.second, feature.second };
+					e.bundled.push_back(value);
+				}
+				std::sort(e.bundled.begin(), e.bundled.end(), [](const bundled_value& lhs, const bundled_value& rhs) {
+					return (lhs.bundle < rhs.bundle) || ((lhs.bundle == rhs.bundle) && (lhs.slot < rhs.slot));
+				});
+				e.bundled.erase(std::unique(e.bundled.begin(), e.bundled.end(), [](const bundled_value& lhs, const bundled_value& rhs) {
+					return lhs.bundle == rhs.bundle;
+				}), e.bundled.end());
+			}
+
+			std::shared_ptr<dictionary> new_dictionary = std::make_shared<dictionary>(*_dictionary);
+			new_dictionary->bundles = bundles;
+			_dictionary = new_dictionary;
+		}
+
+		bool is_bundled() const
 		{
-			return _feature_range;
+			return _dictionary && !_dictionary->bundles.empty();
 		}
 
-		void update_feature_range()
+		std::size_t get_bundle_counts() const
 		{
-			_feature_range.reset();
+			return _dictionary ? _dictionary->bundles.size() : 0;
+		}
 
+	private:
+		void update_dictionary()
+		{
+			std::set<int> ids;
 			for (const auto& e : _data)
 			{
-				if (e.features.begin()->first < _feature_range.min)
+				for (const auto& feature : e.features)
 				{
-					_feature_range.min = e.features.begin()->first;
+					ids.insert(feature.first);
 				}
-				else if (e.features.rbegin()->first > _feature_range.max)
+			}
+
+			std::shared_ptr<dictionary> new_dictionary = std::make_shared<dictionary>();
+			new_dictionary->ids.assign(ids.begin(), ids.end());
+			for (unsigned int i = 0; i < new_dictionary->ids.size(); i++)
+			{
+				new_dictionary->dense[new_dictionary->ids[i]] = i;
+			}
+
+			_dictionary = new_dictionary;
+			_active_features = _dictionary->ids;
+		}
+
+		void update_active_features()
+		{
+			if (!_dictionary)
+			{
+				update_dictionary();
+				return;
+			}
+
+			// Collect the touched dense indices, the marks are cleared again afterwards,
+			// so the cost only depends on the non-zero features and not on the dictionary size.
+			static thread_local std::vector<char> marks;
+			static thread_local std::vector<int> touched;
+			if (marks.size() < _dictionary->ids.size())
+			{
+				marks.resize(_dictionary->ids.size(), 0);
+			}
+			touched.clear();
+			for (const auto& e : _data)
+			{
+				for (const auto& feature : e.features)
 				{
-					_feature_range.max = e.features.rbegin()->first;
+					int dense = get_dense_index(feature.first);
+					if (dense < 0)
+					{
+						throw std::out_of_range("update_active_features(): Feature missing from the dictionary.");
+						std::exit(EXIT_FAILURE);
+					}
+					if (!marks[dense])
+					{
+						marks[dense] = 1;
+						touched.push_back(dense);
+					}
 				}
 			}
+
+			// Dense indices follow the ascending feature ids.
+			std::sort(touched.begin(), touched.end());
+			_active_features.clear();
+			for (const auto& dense : touched)
+			{
+				_active_features.push_back(_dictionary->ids[dense]);
+				marks[dense] = 0;
+			}
 		}
 
 	public:
@@ -325,9 +532,10 @@ namespace dtree
 		void generate_subbranches(int feature_index, std::set<std::tuple<double, double, int> >& sequences)
 		{
 			/*
-			 * (raw value, index)
+			 * (raw value, index), per-thread scratch buffer reused across calls.
 			 */
-			std::vector<std::pair<double, unsigned int> > values;
+			static thread_local std::vector<std::pair<double, unsigned int> > values;
+			values.clear();
 			for (unsigned int index = 0; index < _data.size(); index++)
 			{
 				try
@@ -359,66 +567,246 @@ namespace dtree
 
 			std::sort(values.begin(), values.end());
 
-			auto counts = get_conclusion_counts();
-			int current_pos_counts = 0, current_neg_counts = 0;
-			int remain_pos_counts = std::get<0>(counts), remain_neg_counts = std::get<1>(counts);
+			// (value, pos_counts, neg_counts) of every group of equal values.
+			static thread_local std::vector<std::tuple<double, double, double> > groups;
+			groups.clear();
+			for (const auto& value : values)
+			{
+				const auto& e = _data[value.second];
+				if (e.conclusion == 0)
+				{
+					throw std::domain_error("generate_subbranches(): Undefined conclusion found during the estimation.");
+					std::exit(EXIT_FAILURE);
+				}
+				if (groups.empty() || (std::get<0>(groups.back()) != value.first))
+				{
+					groups.push_back(std::make_tuple(value.first, 0.0, 0.0));
+				}
+				((e.conclusion > 0) ? std::get<1>(groups.back()) : std::get<2>(groups.back())) += e.weight;
+			}
 
-			unsigned int value_index = 0;
-			double old_threshold = -1;
-			for (auto itr = values.begin(); itr != values.end();)
+			generate_subbranches(feature_index, groups, get_conclusion_counts(), sequences);
+		}
+
+		/*
+		 * Split search over the feature bundles, every bundle is sorted once by (slot, value) and only holds
+		 * the non-zero entries, the entries without the feature join the zero group in bulk.
+		 * The candidates carry the original feature ids.
+		 * Parameter: sequences (conusion, threshold, int)
+		 */
+		void generate_bundled_subbranches(std::set<std::tuple<double, double, int> >& sequences)
+		{
+			/*
+			 * (slot, value, index) of every bundle, per-thread scratch buffers reused across calls.
+			 */
+			static thread_local std::vector<std::vector<std::tuple<int, double, unsigned int> > > buckets;
+			static thread_local std::vector<int> touched;
+			buckets.resize(std::max(buckets.size(), _dictionary->bundles.size()));
+			touched.clear();
+			for (unsigned int index = 0; index < _data.size(); index++)
 			{
-				double a = itr->first, b, threshold;
-				if (++itr == values.end())
+				for (const auto& value : _data[index].bundled)
 				{
-					if (a == 0)
+					if (buckets[value.bundle].empty())
 					{
-						threshold = 0;
+						touched.push_back(value.bundle);
 					}
+					buckets[value.bundle].push_back(std::make_tuple(value.slot, value.value, index));
 				}
-				else
+			}
+
+			auto counts = get_conclusion_counts();
+			static thread_local std::vector<std::tuple<double, double, double> > groups;
+			for (const auto& b : touched)
+			{
+				auto& bucket = buckets[b];
+				std::sort(bucket.begin(), bucket.end());
+
+				for (unsigned int begin = 0, end; begin < bucket.size(); begin = end)
 				{
-					b = itr->first;
-					threshold = (a + b) / 2;
+					int slot = std::get<0>(bucket[begin]);
+					for (end = begin; (end < bucket.size()) && (std::get<0>(bucket[end]) == slot); end++)
+					{
+					}
 
-					if (threshold == old_threshold)
+					// Negative groups, the zero group with every entry lacking the feature, positive groups.
+					groups.clear();
+					double zero_pos_counts = std::get<0>(counts), zero_neg_counts = std::get<1>(counts);
+					bool zero_placed = false;
+					for (unsigned int i = begin; i < end; i++)
 					{
-						continue;
+						double value = std::get<1>(bucket[i]);
+						const auto& e = _data[std::get<2>(bucket[i])];
+						if (e.conclusion == 0)
+						{
+							throw std::domain_error("generate_bundled_subbranches(): Undefined conclusion found during the estimation.");
+							std::exit(EXIT_FAILURE);
+						}
+						if (value == 0)
+						{
+							continue;
+						}
+						((e.conclusion > 0) ? zero_pos_counts : zero_neg_counts) -= e.weight;
+
+						if ((value > 0) && !zero_placed)
+						{
+							groups.push_back(std::make_tuple(0.0, 0.0, 0.0));
+							zero_placed = true;
+						}
+						if (groups.empty() || (std::get<0>(groups.back()) != value))
+						{
+							groups.push_back(std::make_tuple(value, 0.0, 0.0));
+						}
+						((e.conclusion > 0) ? std::get<1>(groups.back()) : std::get<2>(groups.back())) += e.weight;
 					}
-					else
+					if (!zero_placed)
 					{
-						old_threshold = threshold;
+						groups.push_back(std::make_tuple(0.0, 0.0, 0.0));
+					}
+
+					for (auto& group : groups)
+					{
+						if (std::get<0>(group) == 0)
+						{
+							std::get<1>(group) = zero_pos_counts;
+							std::get<2>(group) = zero_neg_counts;
+						}
+					}
+					if (zero_pos_counts + zero_neg_counts <= 0)
+					{
+						groups.erase(std::remove_if(groups.begin(), groups.end(), [](const std::tuple<double, double, double>& group) {
+							return std::get<0>(group) == 0;
+						}), groups.end());
 					}
+
+					generate_subbranches(_dictionary->bundles[b][slot], groups, counts, sequences);
+				}
+				bucket.clear();
+			}
+		}
+
+	private:
+		/*
+		 * Walk the groups of equal values in ascending order. A value carried by more than one row is a threshold
+		 * candidate on its own, followed by the midpoint to the next distinct value.
+		 * Parameter: target index, groups (value, pos_counts, neg_counts), weighted (pos_counts, neg_counts), sequences
+		 */
+		void generate_subbranches(int feature_index, const std::vector<std::tuple<double, double, double> >& groups, const std::pair<double, double>& counts, std::set<std::tuple<double, double, int> >& sequences) const
+		{
+			double current_pos_counts = 0, current_neg_counts = 0;
+			double remain_pos_counts = std::get<0>(counts), remain_neg_counts = std::get<1>(counts);
+			double total_counts = remain_pos_counts + remain_neg_counts;
+
+			unsigned int group_index = 0;
+			double old_threshold = -1;
+			for (unsigned int g = 0; g < groups.size(); g++)
+			{
+				double a = std::get<0>(groups[g]);
+
+				double thresholds[2];
+				int threshold_counts = 0;
+				if (std::get<1>(groups[g]) + std::get<2>(groups[g]) > 1)
+				{
+					thresholds[threshold_counts++] = a;
+				}
+				if (g + 1 < groups.size())
+				{
+					thresholds[threshold_counts++] = (a + std::get<0>(groups[g + 1])) / 2;
 				}
 
-				for (; (std::get<0>(values[value_index]) <= threshold) && (value_index < values.size()); value_index++)
+				for (int t = 0; t < threshold_counts; t++)
 				{
-					int entry_conclusion = _data[std::get<1>(values[value_index])].conclusion;
-					if (entry_conclusion > 0)
+					double threshold = thresholds[t];
+					if (threshold == old_threshold)
 					{
-						current_pos_counts++;
-						remain_pos_counts--;
+						continue;
 					}
-					else if (entry_conclusion < 0)
+					else
 					{
-						current_neg_counts++;
-						remain_neg_counts--;
+						old_threshold = threshold;
 					}
-					else
+
+					for (; (group_index < groups.size()) && (std::get<0>(groups[group_index]) <= threshold); group_index++)
 					{
-						throw std::domain_error("generate_subbranches(): Undefined conclusion found during the estimation.");
-						std::exit(EXIT_FAILURE);
+						current_pos_counts += std::get<1>(groups[group_index]);
+						remain_pos_counts -= std::get<1>(groups[group_index]);
+						current_neg_counts += std::get<2>(groups[group_index]);
+						remain_neg_counts -= std::get<2>(groups[group_index]);
+					}
+
+					double pos_confusion = 1 - ((std::pow(remain_pos_counts, 2) + std::pow(remain_neg_counts, 2)) / std::pow((remain_pos_counts + remain_neg_counts), 2));
+					double neg_confusion = 1 - ((std::pow(current_pos_counts, 2) + std::pow(current_neg_counts, 2)) / std::pow((current_pos_counts + current_neg_counts), 2));
+
+					double tmp_confusion = (pos_confusion * (remain_pos_counts + remain_neg_counts) + neg_confusion * (current_pos_counts + current_neg_counts)) / total_counts;
+					if (!std::isnan(tmp_confusion))
+					{
+						sequences.insert(std::make_tuple(tmp_confusion, threshold, feature_index));
 					}
 				}
+			}
+		}
+
+	public:
+		/*
+		 * Extremely randomized split, one threshold drawn uniformly within the observed [min, max) of the feature.
+		 * Only a single counting pass, the values are never sorted.
+		 * Parameter: target index, sequences (conusion, threshold, int), random generator
+		 */
+		template <typename Generator>
+		void generate_random_subbranch(int feature_index, std::set<std::tuple<double, double, int> >& sequences, Generator& g)
+		{
+			double min = std::numeric_limits<double>::infinity(), max = -std::numeric_limits<double>::infinity();
+			for (const auto& e : _data)
+			{
+				auto itr = e.features.find(feature_index);
+				double value = (itr != e.features.end()) ? itr->second : 0;
+				min = std::min(min, value);
+				max = std::max(max, value);
+			}
+			if (!(min < max))
+			{
+				return;
+			}
 
-				double pos_confusion = 1 - ((std::pow(remain_pos_counts, 2) + std::pow(remain_neg_counts, 2)) / std::pow((remain_pos_counts + remain_neg_counts), 2));
-				double neg_confusion = 1 - ((std::pow(current_pos_counts, 2) + std::pow(current_neg_counts, 2)) / std::pow((current_pos_counts + current_neg_counts), 2));
+			double threshold = std::uniform_real_distribution<double>(min, max)(g);
+			if (threshold == 0)
+			{
+				// separate() treats a zero threshold as a presence test.
+				threshold = std::nextafter(threshold, max);
+			}
 
-				double tmp_confusion = (pos_confusion * (remain_pos_counts + remain_neg_counts) + neg_confusion * (current_pos_counts + current_neg_counts)) / _data.size();
-				if (!std::isnan(tmp_confusion))
+			double pos_counts = 0, neg_counts = 0, current_pos_counts = 0, current_neg_counts = 0;
+			for (const auto& e : _data)
+			{
+				auto itr = e.features.find(feature_index);
+				double value = (itr != e.features.end()) ? itr->second : 0;
+				bool below = !(value > threshold);
+				if (e.conclusion > 0)
+				{
+					pos_counts += e.weight;
+					current_pos_counts += below ? e.weight : 0;
+				}
+				else if (e.conclusion < 0)
+				{
+					neg_counts += e.weight;
+					current_neg_counts += below ? e.weight : 0;
+				}
+				else
 				{
-					sequences.insert(std::make_tuple(tmp_confusion, threshold, feature_index));
+					throw std::domain_error("generate_random_subbranch(): Undefined conclusion found during the estimation.");
+					std::exit(EXIT_FAILURE);
 				}
 			}
+			double remain_pos_counts = pos_counts - current_pos_counts, remain_neg_counts = neg_counts - current_neg_counts;
+
+			double pos_confusion = 1 - ((std::pow(remain_pos_counts, 2) + std::pow(remain_neg_counts, 2)) / std::pow((remain_pos_counts + remain_neg_counts), 2));
+			double neg_confusion = 1 - ((std::pow(current_pos_counts, 2) + std::pow(current_neg_counts, 2)) / std::pow((current_pos_counts + current_neg_counts), 2));
+
+			double tmp_confusion = (pos_confusion * (remain_pos_counts + remain_neg_counts) + neg_confusion * (current_pos_counts + current_neg_counts)) / (pos_counts + neg_counts);
+			if (!std::isnan(tmp_confusion))
+			{
+				sequences.insert(std::make_tuple(tmp_confusion, threshold, feature_index));
+			}
 		}
 
 		/*
@@ -437,7 +825,7 @@ namespace dtree
 			for (auto itr = d._data.begin(); itr != d._data.end(); ++itr)
 			{
 				stream << std::endl;
-				stream << itr->conclusion << " [ ";
+				stream << itr->conclusion << " x" << itr->weight << " [ ";
 				for (auto itr2 = itr->features.begin(); itr2 != itr->features.end(); ++itr2)
 				{
 					stream << itr2->first << '(' << itr2->second << ')' << ' ';
@@ -463,7 +851,7 @@ namespace dtree
 		{
 			_data = rhs;
 			update_confusion();
-			update_feature_range();
+			update_active_features();
 
 			return *this;
 		}
@@ -472,7 +860,8 @@ namespace dtree
 		{
 			_data = rhs._data;
 			_confusion = rhs._confusion;
-			_feature_range = rhs._feature_range;
+			_dictionary = rhs._dictionary;
+			_active_features = rhs._active_features;
 
 			return *this;
 		}
@@ -493,6 +882,33 @@ namespace dtree
 			}
 		}
 
+		/*
+		 * Entry accessors.
+		 */
+	public:
+		std::size_t size() const
+		{
+			return _data.size();
+		}
+
+		double get_weight(const int& index) const
+		{
+			return _data.at(index).weight;
+		}
+
+		const std::map<int, double>& get_features(const int& index) const
+		{
+			try
+			{
+				return _data.at(index).features;
+			}
+			catch (std::out_of_range& e)
+			{
+				throw std::out_of_range("get_features(): Entry index out-of-bound.");
+				std::exit(EXIT_FAILURE);
+			}
+		}
+
 		/*
 		 * Get shuffled partial result.
 		 */
@@ -502,17 +918,54 @@ namespace dtree
 			std::random_device rd;
 			std::mt19937 g(rd());
 
-			std::shuffle(_data.begin(), _data.end(), g);
+			// Each of the rows merged into an entry is kept with probability 1 / parted.
+			std::vector<entry> partial_container;
+			for (const auto& e : _data)
+			{
+				std::binomial_distribution<int> picked((int)std::round(e.weight), 1.0 / parted);
+				int counts = picked(g);
+				if (counts > 0)
+				{
+					partial_container.push_back(e);
+					partial_container.back().weight = counts;
+				}
+			}
 
-			std::vector<entry> partial_container(_data.begin(), _data.begin() + _data.size() / parted);
 			dataset partial_set;
+			partial_set._dictionary = _dictionary;
 			partial_set = partial_container;
 			return partial_set;
 		}
 	};
 
+	class compact_tree;
+
+	/*
+	 * Node ordering of the compact representation and the generated code.
+	 *   preorder: positive child first.
+	 *   hot_path: the child reached by more training entries first.
+	 */
+	enum class layout
+	{
+		preorder,
+		hot_path
+	};
+
+	/*
+	 * Threshold search of every node.
+	 *   exact:  every midpoint of the sorted values.
+	 *   random: one uniformly drawn threshold per feature (Extra-Trees).
+	 */
+	enum class splitter
+	{
+		exact,
+		random
+	};
+
 	class if_tree
 	{
+		friend class compact_tree;
+
 		struct node
 		{
 			int feature_index, conclusion;
@@ -520,12 +973,35 @@ namespace dtree
 			node* positive_child;
 			node* negative_child;
 
+			// Training entries reaching this node, used by the pruning passes and the layout.
+			double pos_counts, neg_counts;
+
+			// Confusion of the training entries, the node only branches above the epsilon.
+			double confusion;
+
+			// Traffic rows reaching this node, negative until profile() is called.
+			double hits;
+
 			node()
-				: feature_index(-1), conclusion(1), threshold(-1.0), positive_child(NULL), negative_child(NULL)
+				: feature_index(-1), conclusion(1), threshold(-1.0), positive_child(NULL), negative_child(NULL), pos_counts(0), neg_counts(0),
+				confusion(std::numeric_limits<double>::quiet_NaN()), hits(-1)
 			{
 
 			}
-		};
+
+			bool is_leaf() const
+			{
+				return (positive_child == NULL) && (negative_child == NULL);
+			}
+
+			/*
+			 * Return: traffic hits once profiled, the training entries otherwise. Only used for the layout.
+			 */
+			double get_hits() const
+			{
+				return (hits >= 0) ? hits : (pos_counts + neg_counts);
+			}
+		};
 
 		/*
 		 * Data related private variables.
@@ -533,6 +1009,26 @@ namespace dtree
 	private:
 		dataset _data;
 		double _epsilon;
+		layout _layout;
+		splitter _splitter;
+
+		/*
+		 * Generated code: __builtin_expect on the hot arm, subtrees reached by less than
+		 * _cold_ratio of the root hits are outlined into cold functions (0 disables).
+		 */
+		bool _branch_hints;
+		double _cold_ratio;
+
+		/*
+		 * Generated code indexes attr through this (feature id -> index) table, NULL uses the feature ids.
+		 */
+		const std::map<int, int>* _feature_map;
+
+		/*
+		 * Subtrees with at least _parallel_cutoff entries are built as separate tasks.
+		 */
+		dsched::scheduler* _scheduler;
+		std::size_t _parallel_cutoff;
 
 		/*
 		 * Tree related private variables.
@@ -545,10 +1041,19 @@ namespace dtree
 		 */
 	public:
 		if_tree(const dataset& data, const double& epsilon)
-			: _data(data), _epsilon(epsilon)
+			: _data(data), _epsilon(epsilon), _layout(layout::hot_path), _splitter(splitter::exact), _branch_hints(false), _cold_ratio(0), _feature_map(NULL), _scheduler(NULL), _parallel_cutoff(0), _root(NULL)
 		{
 		}
 
+		/*
+		 * Restore a trained tree from the model file written by save().
+		 */
+		if_tree(std::istream& input)
+			: _epsilon(0), _layout(layout::hot_path), _splitter(splitter::exact), _branch_hints(false), _cold_ratio(0), _feature_map(NULL), _scheduler(NULL), _parallel_cutoff(0), _root(NULL)
+		{
+			load(input);
+		}
+
 		~if_tree()
 		{
 			destroy_tree();
@@ -568,6 +1073,40 @@ namespace dtree
 			_data = data;
 		}
 
+		void set_layout(const layout& order)
+		{
+			_layout = order;
+		}
+
+		void set_splitter(const splitter& method)
+		{
+			_splitter = method;
+		}
+
+		void set_branch_hints(const bool& hints)
+		{
+			_branch_hints = hints;
+		}
+
+		void set_cold_ratio(const double& ratio)
+		{
+			_cold_ratio = ratio;
+		}
+
+		void set_feature_map(const std::map<int, int>* feature_map)
+		{
+			_feature_map = feature_map;
+		}
+
+		/*
+		 * Build subtrees on the scheduler, NULL keeps the construction sequential.
+		 */
+		void set_scheduler(dsched::scheduler* scheduler, const std::size_t& parallel_cutoff = 256)
+		{
+			_scheduler = scheduler;
+			_parallel_cutoff = parallel_cutoff;
+		}
+
 		/*
 		 * Prediction function and its helper functions.
 		 */
@@ -594,13 +1133,17 @@ namespace dtree
 
 			node* current = new node;
 
-			if ((data.get_confusion() <= _epsilon) || !data.can_branch())
-			{
-				current->conclusion = data.get_conclusion();
-			}
-			else
+			auto counts = data.get_conclusion_counts();
+			current->pos_counts = std::get<0>(counts);
+			current->neg_counts = std::get<1>(counts);
+			current->conclusion = data.get_conclusion();
+			current->confusion = data.get_confusion();
+
+			// Every node keeps its majority conclusion, internal ones fall back to it when pruned.
+			if ((data.get_confusion() > _epsilon) && data.can_branch())
 			{
-				auto range = data.get_feature_range();
+				// Features absent from every entry of this node can not separate it, they are never scanned.
+				const auto& features = data.get_active_features();
 
 				/*
 				 * (confusion, threshold, index)
@@ -609,13 +1152,28 @@ namespace dtree
 
 #ifdef DEBUG
 				std::cerr << "********************" << std::endl;
-				std::cerr << "range=[" << range.min << ", " << range.max << "]" << std::endl;
+				std::cerr << "active features=" << features.size() << std::endl;
 				std::cerr << std::endl;
 #endif
 
-				for (int i = range.min; i <= range.max; i++)
+				if (_splitter == splitter::random)
 				{
-					data.generate_subbranches(i, branches);
+					static thread_local std::mt19937 g(std::random_device{}());
+					for (const auto& feature_index : features)
+					{
+						data.generate_random_subbranch(feature_index, branches, g);
+					}
+				}
+				else if (data.is_bundled())
+				{
+					data.generate_bundled_subbranches(branches);
+				}
+				else
+				{
+					for (const auto& feature_index : features)
+					{
+						data.generate_subbranches(feature_index, branches);
+					}
 				}
 
 #ifdef DEBUG
@@ -660,15 +1218,21 @@ namespace dtree
 					}
 #endif
 
-					// Check whether next value needs to be tested
-					current->positive_child = predict(pos);
-					if (current->positive_child == NULL)
-					{
-						continue;
-					}
+					// Large positive subtrees are handed to the scheduler while this thread builds the negative one.
+					dsched::task_group subtrees((pos.size() >= _parallel_cutoff) ? _scheduler : NULL);
+					subtrees.spawn([&]() {
+						current->positive_child = predict(pos);
+					});
 					current->negative_child = predict(neg);
-					if (current->negative_child == NULL)
+					subtrees.wait();
+
+					// Check whether next value needs to be tested
+					if ((current->positive_child == NULL) || (current->negative_child == NULL))
 					{
+						destroy_tree(current->positive_child);
+						destroy_tree(current->negative_child);
+						current->positive_child = NULL;
+						current->negative_child = NULL;
 						continue;
 					}
 
@@ -683,6 +1247,201 @@ namespace dtree
 			return current;
 		}
 
+		/*
+		 * Post-training pruning passes, collapsed subtrees take the majority conclusion of their root.
+		 */
+	public:
+		int get_node_counts() const
+		{
+			return get_node_counts(_root);
+		}
+
+		/*
+		 * Collect the feature indices tested by the tree.
+		 */
+		void get_feature_indices(std::set<int>& indices) const
+		{
+			get_feature_indices(_root, indices);
+		}
+
+		/*
+		 * Reduced-error pruning, a subtree is replaced by a leaf unless that loses accuracy on the validation set.
+		 */
+		void prune_reduced_error(const dataset& validation)
+		{
+			std::vector<int> indices(validation.size());
+			for (unsigned int i = 0; i < indices.size(); i++)
+			{
+				indices[i] = i;
+			}
+			prune_reduced_error(_root, validation, indices);
+			collapse_leaves(_root);
+		}
+
+		/*
+		 * Cost-complexity pruning, keeps the subtree minimizing R(T) + alpha * |leaves(T)|,
+		 * where R(T) is the training misclassification rate.
+		 */
+		void prune_cost_complexity(const double& alpha)
+		{
+			if (_root != NULL)
+			{
+				prune_cost_complexity(_root, alpha, _root->pos_counts + _root->neg_counts);
+			}
+			collapse_leaves(_root);
+		}
+
+		/*
+		 * Cut the tree back to what predict() builds with a larger epsilon: every node whose confusion
+		 * does not exceed it becomes a leaf. Truncating with increasing epsilons yields every model of a sweep
+		 * from a single training run.
+		 */
+		void truncate(const double& epsilon)
+		{
+			truncate(_root, epsilon);
+			_epsilon = std::max(_epsilon, epsilon);
+		}
+
+		/*
+		 * Merge sibling leaves sharing the same conclusion, the predictions are unchanged.
+		 */
+		void collapse_leaves()
+		{
+			collapse_leaves(_root);
+		}
+
+	private:
+		int get_node_counts(const node* leaf) const
+		{
+			if (leaf == NULL)
+			{
+				return 0;
+			}
+			return 1 + get_node_counts(leaf->positive_child) + get_node_counts(leaf->negative_child);
+		}
+
+		void get_feature_indices(const node* leaf, std::set<int>& indices) const
+		{
+			if ((leaf != NULL) && !leaf->is_leaf())
+			{
+				indices.insert(leaf->feature_index);
+				get_feature_indices(leaf->positive_child, indices);
+				get_feature_indices(leaf->negative_child, indices);
+			}
+		}
+
+		void truncate(node* leaf, const double& epsilon)
+		{
+			if ((leaf == NULL) || leaf->is_leaf())
+			{
+				return;
+			}
+
+			if (leaf->confusion <= epsilon)
+			{
+				collapse(leaf);
+			}
+			else
+			{
+				truncate(leaf->positive_child, epsilon);
+				truncate(leaf->negative_child, epsilon);
+			}
+		}
+
+		void collapse(node* leaf)
+		{
+			destroy_tree(leaf->positive_child);
+			destroy_tree(leaf->negative_child);
+			leaf->positive_child = NULL;
+			leaf->negative_child = NULL;
+		}
+
+		/*
+		 * Return: validation errors of the (possibly pruned) subtree.
+		 */
+		double prune_reduced_error(node* leaf, const dataset& validation, const std::vector<int>& indices)
+		{
+			double leaf_errors = 0;
+			for (const auto& index : indices)
+			{
+				if (validation[index] != leaf->conclusion)
+				{
+					leaf_errors += validation.get_weight(index);
+				}
+			}
+
+			if (leaf->is_leaf())
+			{
+				return leaf_errors;
+			}
+
+			std::vector<int> pos_indices, neg_indices;
+			for (const auto& index : indices)
+			{
+				const auto& features = validation.get_features(index);
+				auto itr = features.find(leaf->feature_index);
+				double value = (itr != features.end()) ? itr->second : 0;
+				if (value > leaf->threshold)
+				{
+					pos_indices.push_back(index);
+				}
+				else
+				{
+					neg_indices.push_back(index);
+				}
+			}
+
+			double subtree_errors = prune_reduced_error(leaf->positive_child, validation, pos_indices)
+				+ prune_reduced_error(leaf->negative_child, validation, neg_indices);
+			if (leaf_errors <= subtree_errors)
+			{
+				collapse(leaf);
+				return leaf_errors;
+			}
+			return subtree_errors;
+		}
+
+		/*
+		 * Return: (cost, leaves) of the (possibly pruned) subtree.
+		 */
+		std::pair<double, int> prune_cost_complexity(node* leaf, const double& alpha, const double& total_counts)
+		{
+			double leaf_errors = (leaf->conclusion > 0) ? leaf->neg_counts : leaf->pos_counts;
+			double leaf_cost = leaf_errors / (double)total_counts + alpha;
+
+			if (leaf->is_leaf())
+			{
+				return std::make_pair(leaf_cost, 1);
+			}
+
+			auto pos = prune_cost_complexity(leaf->positive_child, alpha, total_counts);
+			auto neg = prune_cost_complexity(leaf->negative_child, alpha, total_counts);
+			double subtree_cost = std::get<0>(pos) + std::get<0>(neg);
+			if (leaf_cost <= subtree_cost)
+			{
+				collapse(leaf);
+				return std::make_pair(leaf_cost, 1);
+			}
+			return std::make_pair(subtree_cost, std::get<1>(pos) + std::get<1>(neg));
+		}
+
+		void collapse_leaves(node* leaf)
+		{
+			if ((leaf == NULL) || leaf->is_leaf())
+			{
+				return;
+			}
+
+			collapse_leaves(leaf->positive_child);
+			collapse_leaves(leaf->negative_child);
+			if (leaf->positive_child->is_leaf() && leaf->negative_child->is_leaf()
+				&& (leaf->positive_child->conclusion == leaf->negative_child->conclusion))
+			{
+				leaf->conclusion = leaf->positive_child->conclusion;
+				collapse(leaf);
+			}
+		}
+
 		/*
 		 * Tree destoryer and its helper function.
 		 */
@@ -690,6 +1449,7 @@ namespace dtree
 		void destroy_tree()
 		{
 			destroy_tree(_root);
+			_root = NULL;
 		}
 
 	private:
@@ -703,27 +1463,279 @@ namespace dtree
 			}
 		}
 
+		/*
+		 * Count the traffic rows reaching every node, so the hot_path layout and the branch hints follow
+		 * the production distribution. The training counts are left untouched.
+		 */
+	public:
+		void profile(const std::vector<std::map<int, double> >& traffic)
+		{
+			reset_hits(_root);
+			for (const auto& features : traffic)
+			{
+				node* current = _root;
+				while (current != NULL)
+				{
+					current->hits++;
+					if (current->is_leaf())
+					{
+						break;
+					}
+
+					auto itr = features.find(current->feature_index);
+					double value = (itr != features.end()) ? itr->second : 0;
+					current = (value > current->threshold) ? current->positive_child : current->negative_child;
+				}
+			}
+		}
+
+	private:
+		void reset_hits(node* leaf)
+		{
+			if (leaf != NULL)
+			{
+				leaf->hits = 0;
+				reset_hits(leaf->positive_child);
+				reset_hits(leaf->negative_child);
+			}
+		}
+
+		/*
+		 * Evaluate the trained tree in-process, absent features are treated as 0.
+		 */
+	public:
+		int classify(const std::map<int, double>& features) const
+		{
+			const node* current = _root;
+			if (current == NULL)
+			{
+				throw std::runtime_error("classify(): Tree is not trained.");
+				std::exit(EXIT_FAILURE);
+			}
+
+			while ((current->positive_child != NULL) && (current->negative_child != NULL))
+			{
+				auto itr = features.find(current->feature_index);
+				double value = (itr != features.end()) ? itr->second : 0;
+				current = (value > current->threshold) ? current->positive_child : current->negative_child;
+			}
+			return current->conclusion;
+		}
+
+		void classify(const std::vector<std::map<int, double> >& rows, std::vector<int>& conclusions) const
+		{
+			conclusions.resize(rows.size());
+			for (unsigned int i = 0; i < rows.size(); i++)
+			{
+				conclusions[i] = classify(rows[i]);
+			}
+		}
+
+		/*
+		 * Return: weighted fraction of the validation entries classified correctly.
+		 */
+		double get_accuracy(const dataset& validation) const
+		{
+			double correct = 0, total = 0;
+			for (unsigned int i = 0; i < validation.size(); i++)
+			{
+				if (classify(validation.get_features(i)) == validation[i])
+				{
+					correct += validation.get_weight(i);
+				}
+				total += validation.get_weight(i);
+			}
+			return (total > 0) ? (correct / total) : 0;
+		}
+
+		/*
+		 * Model serialization, nodes are written in pre-order with the positive child first.
+		 * Every record ends with the training (positive, negative) counts, they are optional when loading.
+		 *   leaf <conclusion> <pos_counts> <neg_counts> [<hits>]
+		 *   node <feature> <threshold> <pos_counts> <neg_counts> <conclusion> [<hits>]
+		 * The conclusion of an internal node is the leaf it collapses into when truncated or pruned,
+		 * the traffic hits are only written by profiled trees.
+		 */
+	public:
+		void save(std::ostream& stream) const
+		{
+			if (_root == NULL)
+			{
+				throw std::runtime_error("save(): Tree is not trained.");
+				std::exit(EXIT_FAILURE);
+			}
+
+			stream << "tree" << std::endl;
+			save(stream, _root);
+		}
+
+		void load(std::istream& stream)
+		{
+			std::string header;
+			if (!(stream >> header) || (header != "tree"))
+			{
+				throw std::runtime_error("load(): Missing tree header.");
+				std::exit(EXIT_FAILURE);
+			}
+
+			destroy_tree();
+			_root = load_node(stream);
+		}
+
+	private:
+		void save(std::ostream& stream, const node* leaf) const
+		{
+			if ((leaf->positive_child == NULL) && (leaf->negative_child == NULL))
+			{
+				stream << "leaf " << leaf->conclusion << ' ' << leaf->pos_counts << ' ' << leaf->neg_counts;
+				if (leaf->hits >= 0)
+				{
+					stream << ' ' << leaf->hits;
+				}
+				stream << std::endl;
+			}
+			else
+			{
+				stream << "node " << leaf->feature_index << ' '
+					<< std::setprecision(std::numeric_limits<double>::max_digits10) << leaf->threshold << ' '
+					<< leaf->pos_counts << ' ' << leaf->neg_counts << ' ' << leaf->conclusion;
+				if (leaf->hits >= 0)
+				{
+					stream << ' ' << leaf->hits;
+				}
+				stream << std::endl;
+				save(stream, leaf->positive_child);
+				save(stream, leaf->negative_child);
+			}
+		}
+
+		node* load_node(std::istream& input)
+		{
+			std::string line;
+			do
+			{
+				if (!std::getline(input, line))
+				{
+					throw std::runtime_error("load(): Unexpected end of the model.");
+					std::exit(EXIT_FAILURE);
+				}
+			} while (line.find_first_not_of(" \t\r") == std::string::npos);
+
+			std::stringstream stream(line);
+			std::string type;
+			stream >> type;
+
+			node* current = new node;
+			if (type == "leaf")
+			{
+				if (!(stream >> current->conclusion))
+				{
+					delete current;
+					throw std::runtime_error("load(): Malformed leaf.");
+					std::exit(EXIT_FAILURE);
+				}
+			}
+			else if (type == "node")
+			{
+				if (!(stream >> current->feature_index >> current->threshold))
+				{
+					delete current;
+					throw std::runtime_error("load(): Malformed node.");
+					std::exit(EXIT_FAILURE);
+				}
+
+				try
+				{
+					current->positive_child = load_node(input);
+					current->negative_child = load_node(input);
+				}
+				catch (...)
+				{
+					destroy_tree(current);
+					throw;
+				}
+			}
+			else
+			{
+				delete current;
+				throw std::runtime_error("load(): Unknown record \"" + type + "\".");
+				std::exit(EXIT_FAILURE);
+			}
+
+			if (!(stream >> current->pos_counts >> current->neg_counts))
+			{
+				current->pos_counts = current->neg_counts = 0;
+			}
+			else
+			{
+				// Same expression as dataset::update_confusion(), models without counts are never truncated.
+				double total_counts = current->pos_counts + current->neg_counts;
+				current->confusion = 1 - std::pow((current->pos_counts / total_counts), 2) - std::pow((current->neg_counts / total_counts), 2);
+
+				// Models written before internal records carried their conclusion fall back to the majority,
+				// ties keep the default so loading stays deterministic.
+				if (!current->is_leaf() && !(stream >> current->conclusion))
+				{
+					current->conclusion = (current->pos_counts < current->neg_counts) ? -1 : 1;
+				}
+				else if (!(stream >> current->hits))
+				{
+					current->hits = -1;
+				}
+			}
+			return current;
+		}
+
 		/*
 		 * Generate if-else statement.
 		 */
 	public:
 		void generate_file(std::ostream& stream)
 		{
-			stream << "int tree_predict(double *attr) {" << std::endl;
-			generate_file(stream, _root, 1);
-			stream << '}' << std::endl;
+			generate_function(stream, "tree");
 		}
 
 		void generate_file(std::ostream& stream, const int& tree_id)
 		{
-			stream << "int tree" << tree_id << "_predict(double *attr) {" << std::endl;
-			generate_file(stream, _root, 1);
-			stream << '}' << std::endl;
+			generate_function(stream, "tree" + std::to_string(tree_id));
 		}
 
 	private:
 		const std::string indent_character = "  ";
-		void generate_file(std::ostream& stream, node* leaf, int indent)
+
+		/*
+		 * The cold subtrees are collected while the body is generated, so the body is buffered
+		 * until their declarations have been written.
+		 */
+		void generate_function(std::ostream& stream, const std::string& prefix)
+		{
+			std::vector<const node*> cold;
+			double cold_hits = ((_root != NULL) && (_cold_ratio > 0)) ? (_cold_ratio * _root->get_hits()) : 0;
+
+			std::stringstream body;
+			body.flags(stream.flags());
+			body.precision(stream.precision());
+			generate_file(body, _root, 1, prefix, cold_hits, cold);
+
+			for (unsigned int i = 0; i < cold.size(); i++)
+			{
+				stream << "static int " << prefix << "_cold" << i << "(double *attr) __attribute__((cold, noinline));" << std::endl;
+			}
+			stream << "int " << prefix << "_predict(double *attr) {" << std::endl;
+			stream << body.str();
+			stream << '}' << std::endl;
+
+			std::vector<const node*> nested;
+			for (unsigned int i = 0; i < cold.size(); i++)
+			{
+				stream << std::endl;
+				stream << "static int " << prefix << "_cold" << i << "(double *attr) {" << std::endl;
+				generate_file(stream, cold[i], 1, prefix, 0, nested);
+				stream << '}' << std::endl;
+			}
+		}
+
+		void generate_file(std::ostream& stream, const node* leaf, int indent, const std::string& prefix, const double& cold_hits, std::vector<const node*>& cold)
 		{
 			std::string indentations = "";
 			for (int i = 0; i < indent; i++)
@@ -746,16 +1758,280 @@ namespace dtree
 				throw std::runtime_error("generate_file(): Negative child is a null pointer.");
 				std::exit(EXIT_FAILURE);
 			}
+			else if ((indent > 1) && (leaf->get_hits() < cold_hits))
+			{
+				stream << indentations << "return " << prefix << "_cold" << cold.size() << "(attr);" << std::endl;
+				cold.push_back(leaf);
+			}
 			else
 			{
-				stream << indentations << "if(attr[" << leaf->feature_index << "] > " << leaf->threshold << ") {" << std::endl;
-				generate_file(stream, leaf->positive_child, indent + 1);
+				bool swapped = (_layout == layout::hot_path) && (leaf->negative_child->get_hits() > leaf->positive_child->get_hits());
+				const node* first = swapped ? leaf->negative_child : leaf->positive_child;
+				const node* second = swapped ? leaf->positive_child : leaf->negative_child;
+
+				std::stringstream condition;
+				condition.flags(stream.flags());
+				condition.precision(stream.precision());
+				// The swapped test is negated rather than flipped to <=, so NaN still takes the negative arm.
+				condition << (swapped ? "!(" : "") << "attr[" << ((_feature_map != NULL) ? _feature_map->at(leaf->feature_index) : leaf->feature_index)
+					<< "] > " << leaf->threshold << (swapped ? ")" : "");
+
+				if (_branch_hints && (first->get_hits() > second->get_hits()))
+				{
+					stream << indentations << "if(__builtin_expect(" << condition.str() << ", 1)) {" << std::endl;
+				}
+				else
+				{
+					stream << indentations << "if(" << condition.str() << ") {" << std::endl;
+				}
+				generate_file(stream, first, indent + 1, prefix, cold_hits, cold);
 				stream << indentations << "} else {" << std::endl;
-				generate_file(stream, leaf->negative_child, indent + 1);
+				generate_file(stream, second, indent + 1, prefix, cold_hits, cold);
 				stream << indentations << '}' << std::endl;
 			}
 		}
 	};
+
+	/*
+	 * Compact internal node, leaves are not stored as nodes but referenced through a leaf table.
+	 *   feature: bit 31 near child is a leaf, bit 30 near child is the negative one, bits 26-29 near leaf slot,
+	 *            bits 0-25 feature index.
+	 *   far:     bit 31 far child is a leaf and the low bits are its leaf slot, otherwise the node index.
+	 * An internal near child always directly follows its parent.
+	 */
+	struct packed_node
+	{
+		uint32_t feature;
+		float threshold;
+		uint32_t far;
+	};
+	static_assert(sizeof(packed_node) == 12, "packed_node is expected to be 12 bytes");
+
+	class compact_tree
+	{
+	public:
+		static const uint32_t leaf_flag = 0x80000000u;
+		static const uint32_t swap_flag = 0x40000000u;
+		static const uint32_t slot_shift = 26;
+		static const uint32_t slot_mask = 0xFu;
+		static const uint32_t feature_mask = (1u << 26) - 1;
+
+	private:
+		std::vector<packed_node> _nodes;
+		std::vector<int> _leaves;
+		uint32_t _root;
+
+		/*
+		 * Constructors
+		 */
+	public:
+		compact_tree(const if_tree& tree, const layout& order = layout::hot_path)
+		{
+			_root = append(tree, _nodes, _leaves, order);
+		}
+
+		/*
+		 * Flatten a tree into the shared node and leaf tables.
+		 * Return: reference to the root, either a node index or a tagged leaf slot.
+		 */
+	public:
+		static uint32_t append(const if_tree& tree, std::vector<packed_node>& nodes, std::vector<int>& leaves, const layout& order)
+		{
+			if (tree._root == NULL)
+			{
+				throw std::runtime_error("append(): Tree is not trained.");
+				std::exit(EXIT_FAILURE);
+			}
+			return append(tree._root, nodes, leaves, order);
+		}
+
+	private:
+		static uint32_t append(const if_tree::node* leaf, std::vector<packed_node>& nodes, std::vector<int>& leaves, const layout& order)
+		{
+			if ((leaf->positive_child == NULL) || (leaf->negative_child == NULL))
+			{
+				return leaf_flag | leaf_slot(leaf->conclusion, leaves);
+			}
+
+			if ((leaf->feature_index < 0) || ((uint32_t)leaf->feature_index > feature_mask))
+			{
+				throw std::out_of_range("append(): Feature index exceeds the compact representation.");
+				std::exit(EXIT_FAILURE);
+			}
+
+			// The hotter child follows its parent, so the common path stays within a few cache lines.
+			bool swapped = (order == layout::hot_path) && (leaf->negative_child->get_hits() > leaf->positive_child->get_hits());
+			const if_tree::node* near_child = swapped ? leaf->negative_child : leaf->positive_child;
+			const if_tree::node* far_child = swapped ? leaf->positive_child : leaf->negative_child;
+
+			uint32_t index = nodes.size();
+			packed_node current;
+			current.feature = leaf->feature_index | (swapped ? swap_flag : 0);
+			current.threshold = round_down(leaf->threshold);
+			current.far = 0;
+			nodes.push_back(current);
+
+			uint32_t near = append(near_child, nodes, leaves, order);
+			if (near & leaf_flag)
+			{
+				nodes[index].feature |= leaf_flag | ((near & slot_mask) << slot_shift);
+			}
+			uint32_t far = append(far_child, nodes, leaves, order);
+			nodes[index].far = far;
+
+			return index;
+		}
+
+		static uint32_t leaf_slot(const int& conclusion, std::vector<int>& leaves)
+		{
+			auto itr = std::find(leaves.begin(), leaves.end(), conclusion);
+			if (itr != leaves.end())
+			{
+				return itr - leaves.begin();
+			}
+			if (leaves.size() > slot_mask)
+			{
+				throw std::out_of_range("leaf_slot(): Too many distinct conclusions for the compact representation.");
+				std::exit(EXIT_FAILURE);
+			}
+			leaves.push_back(conclusion);
+			return leaves.size() - 1;
+		}
+
+		/*
+		 * Largest float not above the threshold, so "value > threshold" is unchanged for every float input.
+		 */
+		static float round_down(const double& threshold)
+		{
+			float rounded = (float)threshold;
+			if ((double)rounded > threshold)
+			{
+				rounded = std::nextafter(rounded, -std::numeric_limits<float>::infinity());
+			}
+			return rounded;
+		}
+
+		/*
+		 * Scoring, absent features are treated as 0.
+		 */
+	public:
+		template <typename Lookup>
+		static int evaluate(const packed_node* nodes, const int* leaves, uint32_t ref, Lookup lookup)
+		{
+			while (!(ref & leaf_flag))
+			{
+				const packed_node& current = nodes[ref];
+				if ((lookup(current.feature & feature_mask) > current.threshold) != ((current.feature & swap_flag) != 0))
+				{
+					if (current.feature & leaf_flag)
+					{
+						return leaves[(current.feature >> slot_shift) & slot_mask];
+					}
+					ref++;
+				}
+				else
+				{
+					ref = current.far;
+				}
+			}
+			return leaves[ref & slot_mask];
+		}
+
+		int classify(const std::map<int, double>& features) const
+		{
+			return evaluate(_nodes.data(), _leaves.data(), _root, [&features](const uint32_t& feature_index) {
+				auto itr = features.find(feature_index);
+				return (itr != features.end()) ? itr->second : 0.0;
+			});
+		}
+
+		int classify(const double* attr) const
+		{
+			return evaluate(_nodes.data(), _leaves.data(), _root, [attr](const uint32_t& feature_index) {
+				return attr[feature_index];
+			});
+		}
+
+		void classify(const std::vector<std::map<int, double> >& rows, std::vector<int>& conclusions) const
+		{
+			conclusions.resize(rows.size());
+			for (unsigned int i = 0; i < rows.size(); i++)
+			{
+				conclusions[i] = classify(rows[i]);
+			}
+		}
+
+		std::size_t get_node_counts() const
+		{
+			return _nodes.size();
+		}
+
+		std::size_t get_memory_usage() const
+		{
+			return _nodes.size() * sizeof(packed_node) + _leaves.size() * sizeof(int);
+		}
+
+		/*
+		 * Generate table-driven code, the same layout as the in-memory representation.
+		 */
+	public:
+		void generate_file(std::ostream& stream) const
+		{
+			generate_tables(stream, "tree", _nodes, _leaves);
+			generate_walker(stream, "tree");
+			stream << "int tree_predict(double *attr) {" << std::endl;
+			stream << indent_character << "return tree_walk(attr, " << _root << "u);" << std::endl;
+			stream << '}' << std::endl;
+		}
+
+		static void generate_tables(std::ostream& stream, const std::string& prefix, const std::vector<packed_node>& nodes, const std::vector<int>& leaves)
+		{
+			stream << "static const struct { unsigned int feature; float threshold; unsigned int far; } " << prefix << "_nodes[] = {" << std::endl;
+			std::streamsize precision = stream.precision(std::numeric_limits<float>::max_digits10);
+			std::ios_base::fmtflags flags = stream.setf(std::ios_base::showpoint);
+			for (const auto& n : nodes)
+			{
+				stream << indent_character << "{" << n.feature << "u, " << n.threshold << "f, " << n.far << "u}," << std::endl;
+			}
+			if (nodes.empty())
+			{
+				stream << indent_character << "{0u, 0.0f, 0u}" << std::endl;
+			}
+			stream << "};" << std::endl;
+			stream.precision(precision);
+			stream.flags(flags);
+
+			stream << "static const int " << prefix << "_leaves[] = {";
+			for (unsigned int i = 0; i < leaves.size(); i++)
+			{
+				stream << (i ? ", " : "") << leaves[i];
+			}
+			stream << "};" << std::endl;
+			stream << std::endl;
+		}
+
+		static void generate_walker(std::ostream& stream, const std::string& prefix)
+		{
+			const char* i = indent_character;
+			stream << "static int " << prefix << "_walk(double *attr, unsigned int ref) {" << std::endl;
+			stream << i << "while (!(ref & " << leaf_flag << "u)) {" << std::endl;
+			stream << i << i << "const unsigned int feature = " << prefix << "_nodes[ref].feature;" << std::endl;
+			stream << i << i << "if ((attr[feature & " << feature_mask << "u] > " << prefix << "_nodes[ref].threshold) != ((feature & " << swap_flag << "u) != 0)) {" << std::endl;
+			stream << i << i << i << "if (feature & " << leaf_flag << "u)" << std::endl;
+			stream << i << i << i << i << "return " << prefix << "_leaves[(feature >> " << slot_shift << ") & " << slot_mask << "u];" << std::endl;
+			stream << i << i << i << "ref++;" << std::endl;
+			stream << i << i << "} else {" << std::endl;
+			stream << i << i << i << "ref = " << prefix << "_nodes[ref].far;" << std::endl;
+			stream << i << i << '}' << std::endl;
+			stream << i << '}' << std::endl;
+			stream << i << "return " << prefix << "_leaves[ref & " << slot_mask << "u];" << std::endl;
+			stream << '}' << std::endl;
+			stream << std::endl;
+		}
+
+	private:
+		static constexpr const char* indent_character = "  ";
+	};
 }
 
 #endif
@@ -2,18 +2,97 @@
 #include <vector>
 #include <cstdlib>
 #include <fstream>
+#include <string>
+#include <thread>
+#include <algorithm>
 
 #include "dforest.hpp"
+#include "dmodule.hpp"
+#include "dmodel.hpp"
 
 void showUsage(char *argv[]);
 
 int main(int argc, char *argv[])
 {
-	if (argc != 3)
+	if (argc < 3)
 	{
 		showUsage(argv);
 	}
 
+	std::string model_path;
+	std::string module_path;
+	bool compact = false;
+	bool collapse = false;
+	std::string validation_path;
+	double alpha = -1;
+	std::string traffic_path;
+	bool hints = false;
+	double cold_ratio = 0;
+	int max_conflicts = -1;
+	bool reorder = false;
+	dtree::splitter method = dtree::splitter::exact;
+	int threads = std::max(1u, std::thread::hardware_concurrency());
+	for (int i = 3; i < argc; i++)
+	{
+		std::string option(argv[i]);
+		if ((option == "-m") && (i + 1 < argc))
+		{
+			model_path = argv[++i];
+		}
+		else if ((option == "-s") && (i + 1 < argc))
+		{
+			module_path = argv[++i];
+		}
+		else if (option == "-c")
+		{
+			compact = true;
+		}
+		else if (option == "-p")
+		{
+			collapse = true;
+		}
+		else if ((option == "-v") && (i + 1 < argc))
+		{
+			validation_path = argv[++i];
+		}
+		else if ((option == "-a") && (i + 1 < argc))
+		{
+			alpha = std::stof(argv[++i]);
+		}
+		else if ((option == "-t") && (i + 1 < argc))
+		{
+			traffic_path = argv[++i];
+		}
+		else if (option == "-b")
+		{
+			hints = true;
+		}
+		else if ((option == "-o") && (i + 1 < argc))
+		{
+			cold_ratio = std::stof(argv[++i]);
+		}
+		else if ((option == "-g") && (i + 1 < argc))
+		{
+			max_conflicts = std::stoi(argv[++i]);
+		}
+		else if (option == "-k")
+		{
+			reorder = true;
+		}
+		else if (option == "-x")
+		{
+			method = dtree::splitter::random;
+		}
+		else if ((option == "-j") && (i + 1 < argc))
+		{
+			threads = std::stoi(argv[++i]);
+		}
+		else
+		{
+			showUsage(argv);
+		}
+	}
+
 #ifdef DEBUG
 	std::cerr << "Input from: \"" << argv[1] << "\"..." << std::endl;
 #endif
@@ -21,6 +100,12 @@ int main(int argc, char *argv[])
 	std::ifstream input(argv[1]);
 	dtree::dataset matrix(input);
 
+	if (max_conflicts >= 0)
+	{
+		matrix.bundle(max_conflicts);
+		std::cerr << "Bundled features: " << matrix.get_dictionary_size() << " -> " << matrix.get_bundle_counts() << std::endl;
+	}
+
 #ifdef DEBUG
 	std::cerr << "Review the rules" << std::endl;
 	std::cerr << matrix << std::endl;
@@ -28,6 +113,9 @@ int main(int argc, char *argv[])
 
 	dforest::if_forest iforest(matrix, std::stoi(argv[2]));
 
+	dsched::scheduler scheduler(threads);
+	iforest.set_scheduler(&scheduler);
+	iforest.set_splitter(method);
 	iforest.regenerate();
 	iforest.predict();
 
@@ -36,19 +124,82 @@ int main(int argc, char *argv[])
 	std::cerr << std::endl;
 #endif
 
+	if (collapse || !validation_path.empty() || (alpha >= 0))
+	{
+		int before = iforest.get_node_counts();
+
+		if (!validation_path.empty())
+		{
+			std::ifstream validation_input(validation_path);
+			dtree::dataset validation(validation_input);
+			iforest.prune_reduced_error(validation);
+		}
+		if (alpha >= 0)
+		{
+			iforest.prune_cost_complexity(alpha);
+		}
+		iforest.collapse_leaves();
+
+		std::cerr << "Pruned nodes: " << before << " -> " << iforest.get_node_counts() << std::endl;
+	}
+
+	if (reorder)
+	{
+		iforest.reorder(matrix);
+	}
+
+	if (!traffic_path.empty())
+	{
+		// Traffic is usually unlabeled, only the features of every row are used.
+		std::ifstream traffic_input(traffic_path);
+		std::vector<std::map<int, double> > traffic;
+		std::string line;
+		while (std::getline(traffic_input, line))
+		{
+			std::map<int, double> features;
+			int conclusion;
+			if (line.find_first_not_of(" \t\r") != std::string::npos)
+			{
+				dmodel::parse_libsvm(line, features, conclusion);
+				traffic.push_back(features);
+			}
+		}
+		iforest.profile(traffic);
+	}
+	iforest.set_branch_hints(hints);
+	iforest.set_cold_ratio(cold_ratio);
+
+	if (!model_path.empty())
+	{
+		std::ofstream model(model_path);
+		iforest.save(model);
+		model.close();
+	}
+
+	if (!module_path.empty())
+	{
+		dmodule::build_module(iforest, module_path);
+	}
+
 #ifdef IMPLICITLY_TO_FILE
 	std::ofstream output("forest_pred_func.cpp");
-	iforest.generate_file(output);
-	output.close();
 #else
-	iforest.generate_file(std::cout);
+	std::ostream& output = std::cout;
 #endif
+	if (compact)
+	{
+		dforest::compact_forest(iforest).generate_file(output);
+	}
+	else
+	{
+		iforest.generate_file(output);
+	}
 
 	return EXIT_SUCCESS;
 }
 
 void showUsage(char *argv[])
 {
-	std::cout << "Usage: " << argv[0] << " filename" << " trees" << std::endl;
+	std::cout << "Usage: " << argv[0] << " filename" << " trees" << " [-m model] [-c] [-p] [-v validation] [-a alpha] [-j threads] [-x] [-s module] [-t traffic] [-b] [-o cold_ratio] [-g max_conflicts] [-k]" << std::endl;
 	std::exit(EXIT_FAILURE);
 }
\ No newline at end of file
@@ -2,18 +2,119 @@
 #include <vector>
 #include <cstdlib>
 #include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <algorithm>
 
 #include "dtree.hpp"
+#include "dmodule.hpp"
+#include "dmodel.hpp"
 
 void showUsage(char *argv[]);
 
 int main(int argc, char *argv[])
 {
-	if (argc != 3)
+	if (argc < 3)
 	{
 		showUsage(argv);
 	}
 
+	std::string model_path;
+	std::string module_path;
+	bool compact = false;
+	bool collapse = false;
+	std::string validation_path;
+	double alpha = -1;
+	std::string traffic_path;
+	bool hints = false;
+	double cold_ratio = 0;
+	int max_conflicts = -1;
+	std::string report_path;
+	std::vector<std::pair<double, std::string> > sweep;
+	dtree::splitter method = dtree::splitter::exact;
+	int threads = std::max(1u, std::thread::hardware_concurrency());
+	for (int i = 3; i < argc; i++)
+	{
+		std::string option(argv[i]);
+		if ((option == "-m") && (i + 1 < argc))
+		{
+			model_path = argv[++i];
+		}
+		else if ((option == "-s") && (i + 1 < argc))
+		{
+			module_path = argv[++i];
+		}
+		else if (option == "-c")
+		{
+			compact = true;
+		}
+		else if (option == "-p")
+		{
+			collapse = true;
+		}
+		else if ((option == "-v") && (i + 1 < argc))
+		{
+			validation_path = argv[++i];
+		}
+		else if ((option == "-a") && (i + 1 < argc))
+		{
+			alpha = std::stof(argv[++i]);
+		}
+		else if ((option == "-t") && (i + 1 < argc))
+		{
+			traffic_path = argv[++i];
+		}
+		else if (option == "-b")
+		{
+			hints = true;
+		}
+		else if ((option == "-o") && (i + 1 < argc))
+		{
+			cold_ratio = std::stof(argv[++i]);
+		}
+		else if ((option == "-e") && (i + 1 < argc))
+		{
+			std::stringstream list(argv[++i]);
+			std::string epsilon;
+			while (std::getline(list, epsilon, ','))
+			{
+				sweep.push_back(std::make_pair(std::stof(epsilon), epsilon));
+			}
+		}
+		else if ((option == "-r") && (i + 1 < argc))
+		{
+			report_path = argv[++i];
+		}
+		else if ((option == "-g") && (i + 1 < argc))
+		{
+			max_conflicts = std::stoi(argv[++i]);
+		}
+		else if (option == "-x")
+		{
+			method = dtree::splitter::random;
+		}
+		else if ((option == "-j") && (i + 1 < argc))
+		{
+			threads = std::stoi(argv[++i]);
+		}
+		else
+		{
+			showUsage(argv);
+		}
+	}
+
+	// A sweep writes one model per epsilon, the options transforming a single model do not apply.
+	if (!sweep.empty())
+	{
+		if (collapse || !validation_path.empty() || (alpha >= 0) || !model_path.empty() || !module_path.empty())
+		{
+			showUsage(argv);
+		}
+		sweep.push_back(std::make_pair(std::stof(argv[2]), std::string(argv[2])));
+		std::sort(sweep.begin(), sweep.end());
+	}
+
 #ifdef DEBUG
 	std::cerr << "Input from: \"" << argv[1] << "\"..." << std::endl;
 #endif
@@ -21,12 +122,21 @@ int main(int argc, char *argv[])
 	std::ifstream input(argv[1]);
 	dtree::dataset matrix(input);
 
+	if (max_conflicts >= 0)
+	{
+		matrix.bundle(max_conflicts);
+		std::cerr << "Bundled features: " << matrix.get_dictionary_size() << " -> " << matrix.get_bundle_counts() << std::endl;
+	}
+
 #ifdef DEBUG
 	std::cerr << "Review the rules" << std::endl;
 	std::cerr << matrix << std::endl;
 #endif
 
-	dtree::if_tree itree(matrix, std::stof(argv[2]));
+	dsched::scheduler scheduler(threads);
+	dtree::if_tree itree(matrix, sweep.empty() ? std::stof(argv[2]) : sweep.front().first);
+	itree.set_scheduler(&scheduler);
+	itree.set_splitter(method);
 	itree.predict();
 
 #ifdef DEBUG
@@ -34,19 +144,119 @@ int main(int argc, char *argv[])
 	std::cerr << std::endl;
 #endif
 
+	if (collapse || !validation_path.empty() || (alpha >= 0))
+	{
+		int before = itree.get_node_counts();
+
+		if (!validation_path.empty())
+		{
+			std::ifstream validation_input(validation_path);
+			dtree::dataset validation(validation_input);
+			itree.prune_reduced_error(validation);
+		}
+		if (alpha >= 0)
+		{
+			itree.prune_cost_complexity(alpha);
+		}
+		itree.collapse_leaves();
+
+		std::cerr << "Pruned nodes: " << before << " -> " << itree.get_node_counts() << std::endl;
+	}
+
+	if (!traffic_path.empty())
+	{
+		// Traffic is usually unlabeled, only the features of every row are used.
+		std::ifstream traffic_input(traffic_path);
+		std::vector<std::map<int, double> > traffic;
+		std::string line;
+		while (std::getline(traffic_input, line))
+		{
+			std::map<int, double> features;
+			int conclusion;
+			if (line.find_first_not_of(" \t\r") != std::string::npos)
+			{
+				dmodel::parse_libsvm(line, features, conclusion);
+				traffic.push_back(features);
+			}
+		}
+		itree.profile(traffic);
+	}
+	itree.set_branch_hints(hints);
+	itree.set_cold_ratio(cold_ratio);
+
+	std::unique_ptr<dtree::dataset> report;
+	if (!report_path.empty())
+	{
+		std::ifstream report_input(report_path);
+		report.reset(new dtree::dataset(report_input));
+	}
+
+	auto generate = [&](std::ostream& output) {
+		if (compact)
+		{
+			dtree::compact_tree(itree).generate_file(output);
+		}
+		else
+		{
+			itree.generate_file(output);
+		}
+	};
+
+	if (!sweep.empty())
+	{
+		// Every model of the sweep is cut from the same tree, from the smallest epsilon to the largest.
+		for (const auto& epsilon : sweep)
+		{
+			itree.truncate(epsilon.first);
+
+			std::ofstream model("tree_" + epsilon.second + ".model");
+			itree.save(model);
+			model.close();
+
+			std::ofstream output("tree_" + epsilon.second + ".cpp");
+			generate(output);
+			output.close();
+
+			std::cerr << "epsilon " << epsilon.second << ": " << itree.get_node_counts() << " nodes";
+			if (report)
+			{
+				std::cerr << ", accuracy " << itree.get_accuracy(*report);
+			}
+			std::cerr << std::endl;
+		}
+
+		return EXIT_SUCCESS;
+	}
+
+	if (report)
+	{
+		std::cerr << "Accuracy: " << itree.get_accuracy(*report) << std::endl;
+	}
+
+	if (!model_path.empty())
+	{
+		std::ofstream model(model_path);
+		itree.save(model);
+		model.close();
+	}
+
+	if (!module_path.empty())
+	{
+		dmodule::build_module(itree, module_path);
+	}
+
 #ifdef IMPLICITLY_TO_FILE
 	std::ofstream output("tree_pred_func.cpp");
-	itree.generate_file(output);
-	output.close();
 #else
-	itree.generate_file(std::cout);
+	std::ostream& output = std::cout;
 #endif
+	generate(output);
 
 	return EXIT_SUCCESS;
 }
 
 void showUsage(char *argv[])
 {
-	std::cout << "Usage: " << argv[0] << " filename" << " epsilon" << std::endl;
+	std::cout << "Usage: " << argv[0] << " filename" << " epsilon" << " [-m model] [-c] [-p] [-v validation] [-a alpha] [-j threads] [-x] [-s module] [-t traffic] [-b] [-o cold_ratio] [-g max_conflicts] [-e epsilons] [-r validation]" << std::endl;
 	std::exit(EXIT_FAILURE);
 }
\ No newline at end of file
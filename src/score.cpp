@@ -0,0 +1,249 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+
+#include "dmodel.hpp"
+#include "dpipe.hpp"
+
+void showUsage(char *argv[]);
+
+/*
+ * Rows travelling through the pipeline, conclusion 0 marks an unlabeled row.
+ */
+struct batch
+{
+	long sequence;
+	std::vector<std::map<int, double> > rows;
+	std::vector<int> conclusions;
+	std::vector<int> predictions;
+};
+
+/*
+ * Batch scoring: parse -> predict -> write, every stage on its own thread(s) with bounded queues in between,
+ * so the memory use does not depend on the size of the input.
+ */
+int main(int argc, char *argv[])
+{
+	if (argc < 3)
+	{
+		showUsage(argv);
+	}
+
+	std::string output_path;
+	int threads = std::max(1u, std::thread::hardware_concurrency());
+	int batch_rows = 1024;
+	for (int i = 3; i < argc; i++)
+	{
+		std::string option(argv[i]);
+		if (i + 1 >= argc)
+		{
+			showUsage(argv);
+		}
+		else if (option == "-o")
+		{
+			output_path = argv[++i];
+		}
+		else if (option == "-j")
+		{
+			threads = std::stoi(argv[++i]);
+		}
+		else if (option == "-b")
+		{
+			batch_rows = std::stoi(argv[++i]);
+		}
+		else
+		{
+			showUsage(argv);
+		}
+	}
+	if ((threads <= 0) || (batch_rows <= 0))
+	{
+		showUsage(argv);
+	}
+
+	std::shared_ptr<dmodel::model> model;
+	try
+	{
+		model = dmodel::load_model(argv[1]);
+	}
+	catch (const std::exception& error)
+	{
+		std::cerr << "Unable to load \"" << argv[1] << "\": " << error.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+	std::ifstream input(argv[2]);
+	if (!input)
+	{
+		std::cerr << "Unable to open \"" << argv[2] << "\"" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	std::ofstream output_file;
+	if (!output_path.empty())
+	{
+		output_file.open(output_path);
+	}
+	std::ostream& output = output_path.empty() ? std::cout : output_file;
+
+	dpipe::bounded_queue<std::unique_ptr<batch> > parsed(2 * threads), predicted(2 * threads);
+	auto start = std::chrono::steady_clock::now();
+
+	// Batches parsed ahead of the writer, bounds the reorder buffer behind a slow batch.
+	const long window = 4 * threads;
+	long written = 0;
+	std::mutex written_lock;
+	std::condition_variable written_changed;
+
+	// Parse stage, a malformed line stops the run.
+	std::string parse_error;
+	std::thread parser([&]() {
+		std::string line;
+		long line_number = 0;
+		long sequence = 0;
+		std::unique_ptr<batch> current;
+		while (std::getline(input, line))
+		{
+			line_number++;
+			if (line.empty())
+			{
+				continue;
+			}
+			if (!current)
+			{
+				{
+					std::unique_lock<std::mutex> guard(written_lock);
+					written_changed.wait(guard, [&]() { return sequence - written < window; });
+				}
+				current.reset(new batch);
+				current->sequence = sequence++;
+				current->rows.reserve(batch_rows);
+				current->conclusions.reserve(batch_rows);
+			}
+
+			std::map<int, double> features;
+			int conclusion;
+			try
+			{
+				dmodel::parse_libsvm(line, features, conclusion);
+			}
+			catch (std::invalid_argument& e)
+			{
+				parse_error = "line " + std::to_string(line_number) + ": " + e.what();
+				current.reset();
+				break;
+			}
+			current->rows.push_back(std::move(features));
+			current->conclusions.push_back(conclusion);
+
+			if (current->rows.size() >= (std::size_t)batch_rows)
+			{
+				parsed.push(std::move(current));
+			}
+		}
+		if (current)
+		{
+			parsed.push(std::move(current));
+		}
+		parsed.close();
+	});
+
+	// Predict stage.
+	std::vector<std::thread> predictors;
+	for (int i = 0; i < threads; i++)
+	{
+		predictors.push_back(std::thread([&]() {
+			std::unique_ptr<batch> current;
+			while (parsed.pop(current))
+			{
+				model->classify(current->rows, current->predictions);
+				predicted.push(std::move(current));
+			}
+		}));
+	}
+	std::thread closer([&]() {
+		for (auto& predictor : predictors)
+		{
+			predictor.join();
+		}
+		predicted.close();
+	});
+
+	// Write stage, batches finished out of order wait until their turn.
+	long rows = 0, labeled = 0, correct = 0;
+	long matrix[2][2] = { { 0, 0 }, { 0, 0 } };
+	std::map<long, std::unique_ptr<batch> > pending;
+	long next = 0;
+	std::unique_ptr<batch> current;
+	while (predicted.pop(current))
+	{
+		pending[current->sequence] = std::move(current);
+		for (auto itr = pending.find(next); itr != pending.end(); itr = pending.find(++next))
+		{
+			const batch& b = *itr->second;
+			for (std::size_t i = 0; i < b.predictions.size(); i++)
+			{
+				output << b.predictions[i] << '\n';
+				if (b.conclusions[i] != 0)
+				{
+					matrix[b.conclusions[i] > 0 ? 0 : 1][b.predictions[i] > 0 ? 0 : 1]++;
+					if ((b.conclusions[i] > 0) == (b.predictions[i] > 0))
+					{
+						correct++;
+					}
+					labeled++;
+				}
+			}
+			rows += b.predictions.size();
+			pending.erase(itr);
+		}
+		{
+			std::lock_guard<std::mutex> guard(written_lock);
+			written = next;
+		}
+		written_changed.notify_one();
+	}
+	output.flush();
+
+	parser.join();
+	closer.join();
+	if (!parse_error.empty())
+	{
+		std::cerr << "Malformed input at " << parse_error << std::endl;
+		return EXIT_FAILURE;
+	}
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	std::cerr << "model: " << model->describe() << std::endl;
+	std::cerr << std::fixed << std::setprecision(1);
+	std::cerr << "rows: " << rows << " in " << elapsed << " s (" << (elapsed > 0 ? rows / elapsed : 0) << " rows/s)" << std::endl;
+	if (model->get_average_trees() > 0)
+	{
+		std::cerr << "trees per row: " << model->get_average_trees() << std::endl;
+	}
+	if (labeled > 0)
+	{
+		std::cerr << std::setprecision(4) << "accuracy: " << correct / (double)labeled << " (" << correct << '/' << labeled << ')' << std::endl;
+		std::cerr << "confusion matrix (rows: actual, columns: predicted)" << std::endl;
+		std::cerr << std::setw(8) << "" << std::setw(10) << "+1" << std::setw(10) << "-1" << std::endl;
+		std::cerr << std::setw(8) << "+1" << std::setw(10) << matrix[0][0] << std::setw(10) << matrix[0][1] << std::endl;
+		std::cerr << std::setw(8) << "-1" << std::setw(10) << matrix[1][0] << std::setw(10) << matrix[1][1] << std::endl;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+void showUsage(char *argv[])
+{
+	std::cout << "Usage: " << argv[0] << " model" << " filename" << " [-o output] [-j threads] [-b batch_rows]" << std::endl;
+	std::exit(EXIT_FAILURE);
+}
@@ -0,0 +1,127 @@
+#include <iostream>
+#include <cstdlib>
+#include <string>
+#include <memory>
+#include <thread>
+#include <csignal>
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "dserve.hpp"
+
+void showUsage(char *argv[]);
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2)
+	{
+		showUsage(argv);
+	}
+
+	std::string socket_path;
+	int port = -1;
+	std::string host = "127.0.0.1";
+	int workers = std::max(1u, std::thread::hardware_concurrency());
+	int max_batch = 64;
+	int max_delay = 50;
+	for (int i = 2; i < argc; i++)
+	{
+		std::string option(argv[i]);
+		if (i + 1 >= argc)
+		{
+			showUsage(argv);
+		}
+		else if (option == "-u")
+		{
+			socket_path = argv[++i];
+		}
+		else if (option == "-p")
+		{
+			port = std::stoi(argv[++i]);
+		}
+		else if (option == "-h")
+		{
+			host = argv[++i];
+		}
+		else if (option == "-w")
+		{
+			workers = std::stoi(argv[++i]);
+		}
+		else if (option == "-b")
+		{
+			max_batch = std::stoi(argv[++i]);
+		}
+		else if (option == "-d")
+		{
+			max_delay = std::stoi(argv[++i]);
+		}
+		else
+		{
+			showUsage(argv);
+		}
+	}
+	if ((socket_path.empty() == (port < 0)) || (workers <= 0) || (max_batch <= 0) || (max_delay < 0))
+	{
+		showUsage(argv);
+	}
+
+	// Signals are only delivered to the dedicated thread below.
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGHUP);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+	std::unique_ptr<dserve::server> server;
+	try
+	{
+		server.reset(new dserve::server(argv[1], workers, max_batch, max_delay));
+	}
+	catch (const std::exception& error)
+	{
+		std::cerr << "Unable to load \"" << argv[1] << "\": " << error.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+	server->start();
+
+	int listen_fd = socket_path.empty() ? dserve::listen_tcp(port, host) : dserve::listen_unix(socket_path);
+	if (listen_fd < 0)
+	{
+		std::cerr << "Unable to listen on " << (socket_path.empty() ? (host + ':' + std::to_string(port)) : socket_path) << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	std::cerr << "Serving " << server->describe() << " with " << workers << " workers" << std::endl;
+
+	std::thread([&]() {
+		int signal;
+		while (sigwait(&signals, &signal) == 0)
+		{
+			if (signal == SIGHUP)
+			{
+				std::cerr << "reload: " << server->reload() << std::endl;
+			}
+			else
+			{
+				std::cerr << server->report() << std::endl;
+				if (!socket_path.empty())
+				{
+					::unlink(socket_path.c_str());
+				}
+				std::_Exit(EXIT_SUCCESS);
+			}
+		}
+	}).detach();
+
+	server->serve(listen_fd);
+
+	return EXIT_SUCCESS;
+}
+
+void showUsage(char *argv[])
+{
+	std::cout << "Usage: " << argv[0] << " model" << " (-u socket | -p port [-h address])" << " [-w workers] [-b max_batch] [-d max_delay_us]" << std::endl;
+	std::exit(EXIT_FAILURE);
+}